@@ -55,6 +55,7 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long write_req_cnt;   /* Number of write requests. */
   };
 
 const char *block_type_name (enum block_type);
@@ -71,6 +72,8 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_write_multiple (struct block *, block_sector_t,
+                           const void *buffers[], size_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -83,6 +86,12 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Writes CNT consecutive sectors, the Ith from BUFFERS[I], in
+       one request.  Null if the driver can't; block.c then falls
+       back on one write per sector. */
+    void (*write_multiple) (void *aux, block_sector_t,
+                            const void *buffers[], size_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -24,11 +24,24 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* A thread blocked in timer_sleep(). */
+struct sleeper
+  {
+    struct list_elem elem;      /* Element in sleep_list. */
+    int64_t wake;               /* Tick to wake up at. */
+    struct semaphore sema;      /* Upped at that tick. */
+  };
+
+/* Sleeping threads, soonest to wake first.  Guarded by turning
+   interrupts off, since the timer interrupt wakes them. */
+static struct list sleep_list;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static list_less_func wakes_sooner;
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -36,6 +49,7 @@ void
 timer_init (void) 
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
+  list_init (&sleep_list);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -85,15 +99,34 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.  The thread is blocked, not just yielding, until
+   the timer interrupt wakes it. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct sleeper s;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+  s.wake = timer_ticks () + ticks;
+  sema_init (&s.sema, 0);
+  old_level = intr_disable ();
+  list_insert_ordered (&sleep_list, &s.elem, wakes_sooner, NULL);
+  intr_set_level (old_level);
+  sema_down (&s.sema);
+}
+
+/* Returns true if sleeper A wakes before sleeper B. */
+static bool
+wakes_sooner (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED) 
+{
+  const struct sleeper *a = list_entry (a_, struct sleeper, elem);
+  const struct sleeper *b = list_entry (b_, struct sleeper, elem);
+
+  return a->wake < b->wake;
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -171,6 +204,15 @@ static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
+  while (!list_empty (&sleep_list))
+    {
+      struct sleeper *s = list_entry (list_front (&sleep_list),
+                                      struct sleeper, elem);
+      if (s->wake > ticks)
+        break;
+      list_pop_front (&sleep_list);
+      sema_up (&s->sema);
+    }
   thread_tick ();
 }
 
@@ -0,0 +1,38 @@
+/* cachestat.c
+
+   Prints the kernel's buffer cache statistics. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+int
+main (void) 
+{
+  struct cache_stats s;
+  int i;
+
+  if (!cache_stats (&s)) 
+    {
+      printf ("cachestat: not supported\n");
+      return EXIT_FAILURE;
+    }
+  printf ("data:      %llu hits, %llu misses\n", s.hits, s.misses);
+  printf ("metadata:  %llu hits, %llu misses\n", s.meta_hits, s.meta_misses);
+  printf ("size:      %u of at most %u sectors\n", s.sectors, s.max_sectors);
+  printf ("evicted:   %llu sectors\n", s.evictions);
+  printf ("written:   %llu sectors in %llu requests\n",
+          s.write_backs, s.write_requests);
+  printf ("waits:     %llu for locks, %llu for sectors\n",
+          s.lock_waits, s.slot_waits);
+  printf ("miss latency (cycles):\n");
+  for (i = 0; i < CACHE_LATENCY_BUCKETS; i++)
+    if (s.miss_latency[i] != 0) 
+      {
+        if (i < CACHE_LATENCY_BUCKETS - 1)
+          printf ("  < 2^%d: %llu\n", i + CACHE_LATENCY_SHIFT,
+                  s.miss_latency[i]);
+        else
+          printf ("  slower: %llu\n", s.miss_latency[i]);
+      }
+  return EXIT_SUCCESS;
+}
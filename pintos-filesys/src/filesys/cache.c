@@ -1,139 +1,1369 @@
 #include"cache.h"
 #include<string.h>
+#include<hash.h>
 #include"devices/block.h"
 #include"threads/synch.h"
+#include<list.h>
+#include<debug.h>
+#include<stdlib.h>
+#include<round.h>
+#include"threads/thread.h"
+#include"devices/timer.h"
+#include"threads/palloc.h"
+#include"threads/vaddr.h"
+#include"threads/loader.h"
+/* Locking.  A sector is looked up in its Bucket, under that
+   bucket's Lock, which also guards the Pin and Indexed fields of
+   the slots on it.  CacheLock guards the replacement policy,
+   FreeList, the Use and Free fields, the chunks and the hit
+   counts.  Neither kind is ever held across disk I/O or while
+   waiting for a slot, and CacheLock is taken before a bucket lock.
+   A pinned slot's data is guarded by its Rw: readers share it,
+   writers own it, and so does the thread loading the slot from
+   disk, which makes others wanting the same sector wait for that
+   one read only. */
 struct lock CacheLock;
 struct Cache
 {
-	size_t SecNo;
-	bool Use;
-	unsigned Num;
-	bool Dirty;
-	//bool Locked;
-	struct lock Lock;
+	block_sector_t SecNo;
+	bool Use;	//holds SecNo and is known to the policy
+	bool Free;	//on FreeList
+	bool Indexed;	//on its bucket, so lookups find it
+	bool Ref;	//clock reference bit
+	bool Dirty;	//changed since written back; guarded by DirtyLock
+	bool Ahead;	//filled by read-ahead and not read since
+	bool Hot;	//2q: on Am rather than A1in
+	int Idx;	//this slot's number
+	unsigned Pin;	//users that may touch data; never evicted while nonzero
+	struct rwlock Rw;	//shared by readers, owned by writers and the loader
+	struct list_elem BucketElem;	//element of a Bucket while Indexed
+	struct list_elem LruElem;	//element of a policy list while Use, of FreeList while Free
+};
+/* Replacement policy.  Insert() is called once a slot has been
+   filled, Hit() on every later access to it, Remove() when it is
+   evicted, and Victim() picks the slot to evict.  All of them run
+   under CacheLock and must not touch the disk. */
+struct Policy
+{
+	const char *Name;
+	void (*Init)(void);
+	void (*Insert)(int n);
+	void (*Hit)(int n);
+	void (*Remove)(int n);
+	int (*Victim)(void);
 };
-struct Sec
+/* Slots come in chunks of one palloc page each, holding the data
+   of SecsPerPage sectors, and slot N is always in
+   Chunks[N/SecsPerPage].  Chunks are added while the cache is
+   full and below its limit.  When palloc runs out of pages, any
+   chunk none of whose slots is busy may hand its page back; it
+   keeps its place in Chunks[], with its slots off FreeList, until
+   the cache grows again.  The cache never shrinks below
+   CacheMinSize slots. */
+#define SecsPerPage (PGSIZE/BLOCK_SECTOR_SIZE)
+struct Chunk
 {
-	unsigned char data[512];
+	unsigned char *Data;	//palloc page, or NULL if given back
+	bool User;	//Data is from the user pool
+	struct Cache Slots[SecsPerPage];
 };
 unsigned int PassTime=0;
 bool Inited=false;
-struct Sec SecArr[CacheSize];
-struct Cache cache[CacheSize];
+static struct Chunk **Chunks;	//ChunkMax entries, ChunkCnt in use
+static int ChunkCnt,ChunkMax;
+static int ChunkLive;	//chunks in use that have a page
+static int CacheMax;	//limit in sectors from -cache-max, 0 for default
+static unsigned long long PagesReclaimed;	//pages given back to palloc
+static bool grow(void);
+static bool shrink_chunk(struct Chunk *c);
+static size_t cache_shrink(size_t page_cnt);
+static void forget(int n);
+static inline struct Cache *Slot(int n)
+{
+	return &Chunks[n/SecsPerPage]->Slots[n%SecsPerPage];
+}
+static inline unsigned char *SlotData(int n)
+{
+	return Chunks[n/SecsPerPage]->Data+n%SecsPerPage*BLOCK_SECTOR_SIZE;
+}
+/* Number of slots the cache currently has room for. */
+static inline int capacity(void)
+{
+	return ChunkLive*SecsPerPage;
+}
+/* Number of slots in Chunks[], including those of chunks that
+   gave their page back. */
+static inline int slot_cnt(void)
+{
+	return ChunkCnt*SecsPerPage;
+}
+/* Maps a sector number to the slot caching it.  Each bucket has
+   its own lock, so lookups of different sectors rarely wait for
+   each other. */
+struct Bucket
+{
+	struct lock Lock;
+	struct list Slots;	//slots whose SecNo hashes here
+};
+static struct Bucket *Buckets;
+static unsigned BucketCnt;	//a power of two
+static inline struct Bucket *bucket_of(block_sector_t sector)
+{
+	return &Buckets[hash_int(sector)&(BucketCnt-1)];
+}
+/* Slots that hold no sector.  A miss takes one from here, grows
+   the cache if that is empty, or goes through Evict() if it
+   can't. */
+static struct list FreeList;
+static int find(struct Bucket *b,block_sector_t sector);
+static int lookup(block_sector_t sector);
+static int take_slot(void);
+static void free_slot(int n);
+static bool pin_slot(int n,block_sector_t sector);
+static int get_slot(block_sector_t sector,bool read,int flags);
+static void copy_out(int n,void *buffer);
+static void unpin(int n);
+static bool evictable(int n);
+
+/* Write-behind.  A kernel thread writes dirty slots back every
+   FlushPeriod milliseconds, or sooner once more than DirtyBg
+   percent of the cache is dirty.  It blocks on FlushSema between
+   flushes; a second thread ups it once a period.  Writers that
+   push the dirty share past DirtyMax percent wait for the flusher
+   to bring it back down.  All three can be set from the kernel
+   command line. */
+static int FlushPeriod=1000;
+static int DirtyBg=25;
+static int DirtyMax=50;
+static struct lock DirtyLock;	//guards DirtyCnt, FlushGen, FlushKick and Dirty flags
+static struct condition DirtyCond;	//signaled after each flush
+static int DirtyCnt;	//number of dirty slots
+static unsigned FlushGen;	//number of flushes finished
+static bool FlushKick;	//FlushSema is up, the flusher is due
+static struct semaphore FlushSema;	//wakes the flusher
+static struct lock FlushLock;	//one flush at a time, guards FlushOrder
+/* A dirty slot, and the sector it held, when a flush started. */
+struct FlushEntry
+{
+	int Slot;
+	block_sector_t SecNo;
+};
+static struct FlushEntry *FlushOrder;	//dirty slots of the flush in progress
+static void (*FlushHook)(void);	//run first by every flush
+static void flusher(void *aux UNUSED);
+static void flush_ticker(void *aux UNUSED);
+static void kick_flusher(void);
+static void flush_dirty(bool wait);
+/* Dirty sectors at consecutive sector numbers are written back
+   together, up to RunMax at a time, in one device request. */
+#define RunMax 32
+static void write_run(const int run[],int cnt);
+static void end_run(const int run[],int cnt);
+static int gather_run(int n,int run[]);
+static bool join_run(int m);
+static void mark_dirty(int n);
+static void throttle_writer(void);
+
+/* Read-ahead.  cache_readahead() queues sectors that a sequential
+   reader is expected to want soon; the cache-ahead thread loads
+   them so the reader finds them cached.  The queue is a ring that
+   drops requests when full, since read-ahead is only a hint. */
+#define AheadQueueSize 64
+static block_sector_t AheadQueue[AheadQueueSize];
+static int AheadHead,AheadCnt;	//ring position and fill, under AheadLock
+static struct lock AheadLock;
+static struct semaphore AheadSema;	//counts queued requests
+static unsigned long long AheadHits;	//sequential reads found cached
+static unsigned long long AheadMisses;	//sequential reads that went to disk
+static unsigned long long AheadWasted;	//read-ahead sectors evicted unread
+static void read_ahead(void *aux UNUSED);
+
+static void lru_init(void);
+static void lru_insert(int n);
+static void lru_hit(int n);
+static void lru_remove(int n);
+static int lru_victim(void);
+static void clock_init(void);
+static void clock_insert(int n);
+static void clock_hit(int n);
+static void clock_remove(int n);
+static int clock_victim(void);
+static void twoq_init(void);
+static void twoq_insert(int n);
+static void twoq_hit(int n);
+static void twoq_remove(int n);
+static int twoq_victim(void);
+static int oldest_evictable(struct list *list);
+
+static const struct Policy Policies[]=
+{
+	{"lru",lru_init,lru_insert,lru_hit,lru_remove,lru_victim},
+	{"clock",clock_init,clock_insert,clock_hit,clock_remove,clock_victim},
+	{"2q",twoq_init,twoq_insert,twoq_hit,twoq_remove,twoq_victim},
+};
+/* Replacement policy in use, chosen with -cache-policy. */
+static const struct Policy *CurPolicy=&Policies[0];
+/* Lookups that needed the sector's contents, indexed by whether
+   the sector holds metadata (inodes, index blocks, directories).
+   Guarded by CacheLock. */
+static unsigned long long Hits[2],Misses[2];
+/* The rest of the statistics.  Evictions is guarded by CacheLock,
+   the others by StatLock, which is taken last of all. */
+static unsigned long long Evictions;	//sectors dropped to make room or shrink
+static struct lock StatLock;
+static unsigned long long WriteBacks;	//dirty sectors written back
+static unsigned long long WriteRequests;	//device requests doing so
+static unsigned long long LockWaits;	//CacheLock or bucket lock found busy
+static unsigned long long SlotWaits;	//slot Rw found busy
+static unsigned long long MissLatency[CACHE_LATENCY_BUCKETS];	//cycles per read miss
+static void acquire(struct lock *lock);
+static void acquire_slot(int n,bool write);
+static void count_miss(unsigned long long cycles);
+static inline unsigned long long rdtsc(void);
+
+/* Selects the replacement policy called NAME.  Must be called
+   before cache_init().  Panics if there is no such policy. */
+void cache_set_policy(const char *name)
+{
+	size_t i;
+	if(name==NULL)
+		PANIC("-cache-policy requires a policy name");
+	for(i=0;i<sizeof Policies/sizeof *Policies;i++)
+		if(!strcmp(name,Policies[i].Name))
+		{
+			CurPolicy=&Policies[i];
+			return;
+		}
+	PANIC("unknown cache policy `%s'",name);
+}
+/* Sets the write-behind period to MS milliseconds. */
+void cache_set_flush_period(int ms)
+{
+	if(ms<=0)
+		PANIC("cache flush period must be positive");
+	FlushPeriod=ms;
+}
+/* Sets the dirty percentage that wakes the flusher early. */
+void cache_set_dirty_bg(int pct)
+{
+	DirtyBg=pct;
+}
+/* Sets the dirty percentage at which writers are throttled. */
+void cache_set_dirty_max(int pct)
+{
+	DirtyMax=pct;
+}
+/* Makes every write-back first call HOOK, which may write to the
+   cache itself, to get data kept elsewhere in memory, like the
+   free map, into the cache in time to go out with the rest.  HOOK
+   runs holding FlushLock, so its writes are never throttled. */
+void cache_set_flush_hook(void (*hook)(void))
+{
+	FlushHook=hook;
+}
+/* Lets the cache grow to SECTORS sectors. */
+void cache_set_max(int sectors)
+{
+	if(sectors<CacheMinSize)
+		PANIC("cache limit must be at least %d sectors",CacheMinSize);
+	CacheMax=sectors;
+}
 void cache_init(void)
 {
-	int i;
-	for(i=0;i<CacheSize;i++)
+	unsigned i;
+	/* By default the cache may take an eighth of RAM. */
+	if(CacheMax==0)
+		CacheMax=init_ram_pages/8*SecsPerPage;
+	if(CacheMax<CacheMinSize)
+		CacheMax=CacheMinSize;
+	ChunkMax=DIV_ROUND_UP(CacheMax,SecsPerPage);
+	/* About four slots to a bucket when the cache is full. */
+	for(BucketCnt=16;BucketCnt*4<(unsigned)ChunkMax*SecsPerPage;BucketCnt*=2)
+		continue;
+	Chunks=malloc(ChunkMax*sizeof *Chunks);
+	FlushOrder=malloc(ChunkMax*SecsPerPage*sizeof *FlushOrder);
+	Buckets=malloc(BucketCnt*sizeof *Buckets);
+	if(Chunks==NULL||FlushOrder==NULL||Buckets==NULL)
+		PANIC("can't allocate buffer cache");
+	for(i=0;i<BucketCnt;i++)
 	{
-		cache[i].SecNo=0;
-		cache[i].Use=false;
-		cache[i].Num=0;
-		cache[i].Dirty=false;
-		lock_init(&cache[i].Lock);
+		lock_init(&Buckets[i].Lock);
+		list_init(&Buckets[i].Slots);
 	}
 	PassTime=0;
+	ChunkCnt=ChunkLive=0;
+	list_init(&FreeList);
+	while(capacity()<CacheMinSize)
+		if(!grow())
+			PANIC("can't allocate buffer cache");
 	lock_init(&CacheLock);
+	lock_init(&StatLock);
+	CurPolicy->Init();
+	if(DirtyBg<0||DirtyMax<=DirtyBg||DirtyMax>100)
+		PANIC("bad cache dirty ratios %d%%/%d%%",DirtyBg,DirtyMax);
+	lock_init(&DirtyLock);
+	cond_init(&DirtyCond);
+	lock_init(&FlushLock);
+	DirtyCnt=0;
+	FlushGen=0;
+	FlushKick=false;
+	sema_init(&FlushSema,0);
+	lock_init(&AheadLock);
+	sema_init(&AheadSema,0);
+	AheadHead=AheadCnt=0;
+	palloc_set_shrinker(cache_shrink);
 	Inited=true;
+	thread_create("cache-flush",PRI_DEFAULT,flusher,NULL);
+	thread_create("cache-tick",PRI_DEFAULT,flush_ticker,NULL);
+	thread_create("cache-ahead",PRI_DEFAULT,read_ahead,NULL);
 }
 
 void cache_read(block_sector_t sector,void *buffer)
 {	
-	int n=in_cache(sector);
-	if(n==-1)
-		n=Fetch(sector);
-	lock_acquire(&cache[n].Lock);
-	ASSERT(n!=-1);
-	memcpy(buffer,SecArr[n].data,BLOCK_SECTOR_SIZE);
-	hit_count(n);
-	lock_release(&cache[n].Lock);
-//	Fetch(sector+1);
+	copy_out(get_slot(sector,true,0),buffer);
 }
+/* Like cache_read(), for a sector of file system metadata, which
+   is only counted separately in the statistics. */
+void cache_read_meta(block_sector_t sector,void *buffer)
+{
+	copy_out(get_slot(sector,true,CACHE_META),buffer);
+}
+/* Copies slot N, pinned and held for reading, into BUFFER and
+   releases it. */
+static void copy_out(int n,void *buffer)
+{
+	memcpy(buffer,SlotData(n),BLOCK_SECTOR_SIZE);
+	rw_release(&Slot(n)->Rw);
+	unpin(n);
+}
+/* Overwrites all of SECTOR, so a miss doesn't read the old
+   contents from disk. */
 void cache_write(block_sector_t sector,const void *buffer)
 {
-	int n=in_cache(sector);
-	if(n==-1)
-		n=Fetch(sector);
-	lock_acquire(&cache[n].Lock);
-	memcpy(SecArr[n].data,buffer,BLOCK_SECTOR_SIZE);
-	cache[n].Dirty=true;
-	hit_count(n);
-	lock_release(&cache[n].Lock);
+	int n=get_slot(sector,false,CACHE_WRITE);
+	memcpy(SlotData(n),buffer,BLOCK_SECTOR_SIZE);
+	mark_dirty(n);
+	rw_release(&Slot(n)->Rw);
+	unpin(n);
+	throttle_writer();
 }
-int Fetch(block_sector_t sector)
+/* Fills SECTOR with zeros, without reading it from disk.  Meant
+   for sectors that have just been allocated, usually while the
+   index block pointing to them is held, so unlike cache_write()
+   this never waits for the flusher. */
+void cache_zero(block_sector_t sector)
 {
-	lock_acquire(&CacheLock);
-	int i,n=-1;
-	for(i=0;i<CacheSize;i++)
-	if(cache[i].Use==false)
+	int n=get_slot(sector,false,CACHE_WRITE);
+	memset(SlotData(n),0,BLOCK_SECTOR_SIZE);
+	mark_dirty(n);
+	rw_release(&Slot(n)->Rw);
+	unpin(n);
+}
+/* Pins SECTOR in the cache, reading it in if needed, and returns
+   a pointer to its BLOCK_SECTOR_SIZE bytes of cached data.  The
+   pointer stays valid, and the sector stays cached, until the
+   slot stored in *HANDLE is passed to cache_put().  This lets a
+   caller look at or change a few bytes of a sector in place
+   instead of copying the whole sector through cache_read().
+   FLAGS is a combination of CACHE_META, if the sector holds
+   metadata, and CACHE_WRITE, if the caller may change the data;
+   without CACHE_WRITE other readers may share the sector. */
+void *cache_get(block_sector_t sector,int *handle,int flags)
+{
+	*handle=get_slot(sector,true,flags);
+	return SlotData(*handle);
+}
+/* Releases a sector taken by cache_get().  DIRTY says whether
+   the caller modified the data, which it may only have done if it
+   passed CACHE_WRITE. */
+void cache_put(int handle,bool dirty)
+{
+	ASSERT(handle>=0&&handle<slot_cnt());
+	if(dirty)
 	{
-		n=i;
-		break;
+		ASSERT(rw_held_for_write(&Slot(handle)->Rw));
+		mark_dirty(handle);
+	}
+	rw_release(&Slot(handle)->Rw);
+	unpin(handle);
+	if(dirty)
+		throttle_writer();
+}
+/* Returns the slot holding SECTOR, pinned and held for writing if
+   FLAGS has CACHE_WRITE or for reading if not.  On a miss the
+   sector is read from disk if READ is true, or left for the
+   caller to overwrite, which needs CACHE_WRITE, if not.  Lookups
+   that read count as a hit or miss of the data or, with
+   CACHE_META, the metadata kind. */
+static int get_slot(block_sector_t sector,bool read,int flags)
+{
+	bool meta=(flags&CACHE_META)!=0;
+	bool write=(flags&CACHE_WRITE)!=0;
+	int n=lookup(sector);
+	bool hit=n!=-1;
+	ASSERT(read||write);
+	if(!hit)
+	{
+		unsigned long long start=rdtsc();
+		n=Fetch(sector,read,false);
+		if(read)
+			count_miss(rdtsc()-start);
+	}
+	Slot(n)->Ahead=false;
+	acquire(&CacheLock);
+	/* A slot still being loaded isn't known to the policy yet. */
+	if(hit&&Slot(n)->Use)
+		CurPolicy->Hit(n);
+	if(read)
+	{
+		if(hit)
+			Hits[meta]++;
+		else
+			Misses[meta]++;
 	}
-	if(n==-1)
-		n=Evict();
-	fs_device->ops->read(fs_device->aux,sector,SecArr[n].data);
-	fs_device->read_cnt++;
-	cache[n].Use=true;
-	cache[n].SecNo=sector;
-	cache[n].Num=0;
-	cache[n].Dirty=false;
 	lock_release(&CacheLock);
-//	printf("Fetch run\n");
+	if(hit)
+		acquire_slot(n,write);
+	else if(!write)
+	{
+		/* Loaded: let other readers in. */
+		rw_release(&Slot(n)->Rw);
+		rw_acquire_read(&Slot(n)->Rw);
+	}
 	return n;
 }
-int in_cache(block_sector_t sector)
+/* Returns the slot on B holding SECTOR, or -1 if there is none.
+   Caller must hold B's Lock. */
+static int find(struct Bucket *b,block_sector_t sector)
 {
-	int i;
-	for(i=0;i<CacheSize;i++)
-		if(cache[i].Use==true && cache[i].SecNo==sector)
-			return i;
+	struct list_elem *e;
+	for(e=list_begin(&b->Slots);e!=list_end(&b->Slots);e=list_next(e))
+	{
+		struct Cache *s=list_entry(e,struct Cache,BucketElem);
+		if(s->SecNo==sector)
+			return s->Idx;
+	}
 	return -1;
 }
+/* Returns the slot caching SECTOR, pinned, or -1 if SECTOR is
+   not cached. */
+static int lookup(block_sector_t sector)
+{
+	struct Bucket *b=bucket_of(sector);
+	int n;
+	acquire(&b->Lock);
+	n=find(b,sector);
+	if(n!=-1)
+		Slot(n)->Pin++;
+	lock_release(&b->Lock);
+	return n;
+}
+/* Pins slot N if it still holds SECTOR, as it did when the caller
+   last looked.  Returns true if it does. */
+static bool pin_slot(int n,block_sector_t sector)
+{
+	struct Bucket *b=bucket_of(sector);
+	bool ok;
+	lock_acquire(&CacheLock);	//keeps slot N from being freed
+	ok=n<slot_cnt();
+	if(ok)
+	{
+		lock_acquire(&b->Lock);
+		ok=Slot(n)->Indexed&&Slot(n)->SecNo==sector;
+		if(ok)
+			Slot(n)->Pin++;
+		lock_release(&b->Lock);
+	}
+	lock_release(&CacheLock);
+	return ok;
+}
+/* Drops one pin on slot N. */
+static void unpin(int n)
+{
+	struct Bucket *b=bucket_of(Slot(n)->SecNo);
+	acquire(&b->Lock);
+	ASSERT(Slot(n)->Pin>0);
+	Slot(n)->Pin--;
+	lock_release(&b->Lock);
+}
+/* Returns true if slot N may be evicted.  Caller must hold
+   CacheLock.  Pin is read without its bucket lock, so the answer
+   has to be checked again under that lock. */
+static bool evictable(int n)
+{
+	return Slot(n)->Use&&Slot(n)->Pin==0;
+}
+/* Loads SECTOR into a free or evicted slot and returns the slot,
+   pinned and held for writing.  The sector is read from disk only
+   if READ is true.  AHEAD marks the slot as filled by read-ahead.
+   If another thread loads SECTOR first, returns its slot instead,
+   once that load is done. */
+int Fetch(block_sector_t sector,bool read,bool ahead)
+{
+	struct Bucket *b=bucket_of(sector);
+	int n=take_slot(),m;
+	struct Cache *s=Slot(n);
+	ASSERT(!s->Dirty);
+	rw_acquire_write(&s->Rw);	//nobody else can see the slot yet
+	s->SecNo=sector;
+	s->Ahead=ahead;
+	s->Pin=1;
+	acquire(&b->Lock);
+	m=find(b,sector);
+	if(m!=-1)
+	{
+		Slot(m)->Pin++;
+		lock_release(&b->Lock);
+		rw_release(&s->Rw);
+		s->Pin=0;
+		free_slot(n);
+		acquire_slot(m,true);
+		return m;
+	}
+	s->Indexed=true;
+	list_push_front(&b->Slots,&s->BucketElem);
+	lock_release(&b->Lock);
+	if(read)
+	{
+		fs_device->ops->read(fs_device->aux,sector,SlotData(n));
+		fs_device->read_cnt++;
+	}
+	lock_acquire(&CacheLock);
+	s->Use=true;
+	CurPolicy->Insert(n);
+	lock_release(&CacheLock);
+	return n;
+}
+/* Returns the slot caching SECTOR, or -1 if it is not cached.
+   The slot isn't pinned, so the answer is only a hint. */
+int in_cache(block_sector_t sector)
+{
+	struct Bucket *b=bucket_of(sector);
+	int n;
+	lock_acquire(&b->Lock);
+	n=find(b,sector);
+	lock_release(&b->Lock);
+	return n;
+}
+/* Returns a slot that holds no sector, for the caller to fill:
+   a free one, one from a new chunk if the cache may grow, or an
+   evicted one. */
+static int take_slot(void)
+{
+	struct Cache *s=NULL;
+	acquire(&CacheLock);
+	if(list_empty(&FreeList)&&ChunkLive<ChunkMax)
+		grow();
+	if(!list_empty(&FreeList))
+	{
+		s=list_entry(list_pop_front(&FreeList),struct Cache,LruElem);
+		s->Free=false;
+	}
+	lock_release(&CacheLock);
+	return s!=NULL?s->Idx:Evict();
+}
+/* Puts slot N, which holds no sector, back on FreeList. */
+static void free_slot(int n)
+{
+	lock_acquire(&CacheLock);
+	Slot(n)->Free=true;
+	list_push_front(&FreeList,&Slot(n)->LruElem);
+	lock_release(&CacheLock);
+}
 
 
 
+/* Takes the slot chosen by the replacement policy away from the
+   sector it holds and returns it.  A dirty victim is written back
+   first, with no lock but its Rw held, and then the choice is
+   made again, since the slot may have been used meanwhile. */
 int Evict()
 {
-	int i,n=-1;
-	unsigned int maxn=0;
-	for(i=0;i<CacheSize;i++)
+	for(;;)
 	{
-	if(cache[i].Use==true&&cache[i].Num>=maxn)
+		int n;
+		struct Bucket *b;
+		bool dirty;
+		acquire(&CacheLock);
+		n=CurPolicy->Victim();
+		if(n==-1)
+			PANIC("every buffer cache slot is pinned");
+		b=bucket_of(Slot(n)->SecNo);
+		acquire(&b->Lock);
+		if(Slot(n)->Pin>0)
+		{
+			/* Pinned since Victim() looked; choose again. */
+			lock_release(&b->Lock);
+			lock_release(&CacheLock);
+			continue;
+		}
+		dirty=Slot(n)->Dirty;
+		if(dirty)
+			Slot(n)->Pin++;
+		else
+		{
+			Slot(n)->Indexed=false;
+			list_remove(&Slot(n)->BucketElem);
+		}
+		lock_release(&b->Lock);
+		if(!dirty)
+			forget(n);
+		lock_release(&CacheLock);
+		if(!dirty)
+		{
+//			printf("Evict run\n");
+			return n;
+		}
 		{
-			maxn=cache[i].Num;
-			n=i;
+			int run[RunMax],cnt;
+			rw_acquire_read(&Slot(n)->Rw);
+			cnt=gather_run(n,run);
+			write_run(run,cnt);
+			end_run(run,cnt);
 		}
 	}
-	lock_acquire(&cache[n].Lock);
-	ASSERT(n!=-1);
-	write_back(n);
-	cache[n].Use=false;
-	lock_release(&cache[n].Lock);
-//	printf("Evict run\n");
-	return n;
 }
+/* Holds slot M, which is pinned, for reading if it is dirty and
+   that needs no waiting.  The evicting thread may itself hold M
+   for writing, as when it loads one extent block while holding
+   its parent, and then M is left out. */
+static bool join_run(int m)
+{
+	struct rwlock *rw=&Slot(m)->Rw;
+	return Slot(m)->Dirty&&!rw_held_for_write(rw)&&rw_try_acquire_read(rw);
+}
+/* Puts slot N, which is pinned and held for reading, into RUN
+   along with the dirty sectors just before and after it that can
+   be pinned and held for reading without waiting, and returns
+   the length of RUN.  RUN is in sector order, and each slot in it
+   is pinned and held. */
+static int gather_run(int n,int run[])
+{
+	block_sector_t first=Slot(n)->SecNo,last=first;
+	int before[RunMax-1],nb=0,cnt=0,i;
+	/* Grab the sectors after N first, so the ones before it can
+	   fill whatever room is left. */
+	run[cnt++]=n;
+	while(cnt<RunMax&&last+1<block_size(fs_device))
+	{
+		int m=lookup(last+1);
+		if(m==-1)
+			break;
+		if(!join_run(m))
+		{
+			unpin(m);
+			break;
+		}
+		run[cnt++]=m;
+		last++;
+	}
+	while(cnt+nb<RunMax&&first>0)
+	{
+		int m=lookup(first-1);
+		if(m==-1)
+			break;
+		if(!join_run(m))
+		{
+			unpin(m);
+			break;
+		}
+		before[nb++]=m;
+		first--;
+	}
+	if(nb>0)
+	{
+		memmove(run+nb,run,cnt*sizeof *run);
+		for(i=0;i<nb;i++)
+			run[i]=before[nb-1-i];
+		cnt+=nb;
+	}
+	return cnt;
+}
+/* Takes slot N, which is no longer Indexed, out of the policy.
+   Caller must hold CacheLock. */
+static void forget(int n)
+{
+	if(Slot(n)->Ahead)
+		AheadWasted++;
+	Evictions++;
+	CurPolicy->Remove(n);
+	Slot(n)->Use=false;
+}
+/* Adds a chunk of free slots to the cache, giving a page back to
+   a chunk that lacks one or else adding a chunk at the end.
+   Returns false if palloc is out of pages.  Caller must hold
+   CacheLock, except during cache_init(). */
+static bool grow(void)
+{
+	struct Chunk *c=NULL;
+	int i;
+	ASSERT(ChunkLive<ChunkMax);
+	for(i=0;i<ChunkCnt&&c==NULL;i++)
+		if(Chunks[i]->Data==NULL)
+			c=Chunks[i];
+	if(c==NULL)
+	{
+		c=malloc(sizeof *c);
+		if(c==NULL)
+			return false;
+		for(i=0;i<SecsPerPage;i++)
+		{
+			struct Cache *s=&c->Slots[i];
+			s->SecNo=0;
+			s->Use=false;
+			s->Free=true;
+			s->Indexed=false;
+			s->Ref=false;
+			s->Dirty=false;
+			s->Ahead=false;
+			s->Pin=0;
+			s->Idx=ChunkCnt*SecsPerPage+i;
+			rw_init(&s->Rw);
+		}
+		c->Data=NULL;
+		Chunks[ChunkCnt++]=c;
+	}
+	/* The kernel pool is the cache's own, but when it runs dry a
+	   page the user pool isn't using does just as well, since
+	   the shrinker gives it back on demand. */
+	c->User=false;
+	c->Data=palloc_get_page(0);
+	if(c->Data==NULL)
+	{
+		c->User=true;
+		c->Data=palloc_get_page(PAL_USER);
+	}
+	if(c->Data==NULL)
+		return false;
+	for(i=0;i<SecsPerPage;i++)
+		list_push_back(&FreeList,&c->Slots[i].LruElem);
+	ChunkLive++;
+	return true;
+}
+/* Returns true if one of C's slots is being loaded or evicted,
+   pinned or dirty.  Only a hint, since the bucket locks aren't
+   held. */
+static bool chunk_busy(const struct Chunk *c)
+{
+	int i;
+	for(i=0;i<SecsPerPage;i++)
+	{
+		const struct Cache *s=&c->Slots[i];
+		if(!s->Free&&(!s->Use||s->Pin>0||s->Dirty))
+			return true;
+	}
+	return false;
+}
+/* Gives chunk C's page back to palloc.  Returns false if the
+   cache is at its minimum size or one of the chunk's slots is in
+   use, dirty or pinned; the clean, unpinned ones are still freed.
+   Dirty slots are left for the flusher, since palloc's caller may
+   not be able to wait for the disk.  Caller must hold CacheLock. */
+static bool shrink_chunk(struct Chunk *c)
+{
+	int first=c->Slots[0].Idx,n;
+	if(capacity()-SecsPerPage<CacheMinSize)
+		return false;
+	for(n=first;n<first+SecsPerPage;n++)
+	{
+		struct Cache *s=Slot(n);
+		struct Bucket *b;
+		bool ok;
+		if(s->Free)
+			continue;
+		if(!s->Use)
+			return false;	//being loaded or evicted
+		b=bucket_of(s->SecNo);
+		lock_acquire(&b->Lock);
+		ok=s->Pin==0&&!s->Dirty;
+		if(ok)
+		{
+			s->Indexed=false;
+			list_remove(&s->BucketElem);
+		}
+		lock_release(&b->Lock);
+		if(!ok)
+		{
+			if(s->Dirty)
+			{
+				lock_acquire(&DirtyLock);
+				kick_flusher();
+				lock_release(&DirtyLock);
+			}
+			return false;
+		}
+		forget(n);
+		s->Free=true;
+		list_push_back(&FreeList,&s->LruElem);
+	}
+	for(n=first;n<first+SecsPerPage;n++)
+		list_remove(&Slot(n)->LruElem);
+	palloc_free_page(c->Data);
+	c->Data=NULL;
+	ChunkLive--;
+	PagesReclaimed++;
+	return true;
+}
+/* Called by palloc when it is about to fail an allocation: gives
+   back up to PAGE_CNT pages and returns how many it freed.
+   palloc may be called with any lock held, including CacheLock
+   or a malloc lock that a thread holding CacheLock is waiting
+   for, so this gives up rather than wait for CacheLock.  Pages
+   taken from the user pool go first, since the cache only has
+   them because the kernel pool ran dry; busy chunks are
+   skipped. */
+static size_t cache_shrink(size_t page_cnt)
+{
+	size_t freed=0;
+	int pass,i;
+	if(lock_held_by_current_thread(&CacheLock)||!lock_try_acquire(&CacheLock))
+		return 0;
+	for(pass=0;pass<2;pass++)
+		for(i=ChunkCnt-1;i>=0&&freed<page_cnt;i--)
+		{
+			struct Chunk *c=Chunks[i];
+			if(c->Data!=NULL&&c->User==(pass==0)&&!chunk_busy(c)
+				&&shrink_chunk(c))
+				freed++;
+		}
+	lock_release(&CacheLock);
+	return freed;
+}
+/* Writes slot N back to disk, if it is dirty, and marks it clean.
+   Caller must have N pinned and hold its Rw. */
 void write_back(int n)
 {
-	fs_device->ops->write(fs_device->aux,cache[n].SecNo,SecArr[n].data);
-	fs_device->write_cnt++;
-	cache[n].Dirty=false;
+	write_run(&n,1);
 }
-void cache_close(void)
+/* Writes back the dirty ones among the CNT slots in RUN, which
+   hold consecutive sectors and are pinned and held by the caller,
+   and marks them clean.  Each stretch of dirty slots goes to the
+   device as one request. */
+static void write_run(const int run[],int cnt)
 {
-	write_back_all();
+	const void *bufs[RunMax];
+	bool dirty[RunMax];
+	int i,j;
+	ASSERT(cnt<=RunMax);
+	lock_acquire(&DirtyLock);
+	for(i=0;i<cnt;i++)
+	{
+		dirty[i]=Slot(run[i])->Dirty;
+		if(dirty[i])
+		{
+			Slot(run[i])->Dirty=false;
+			DirtyCnt--;
+		}
+	}
+	lock_release(&DirtyLock);
+	for(i=0;i<cnt;i=j+1)
+	{
+		for(j=i;j<cnt&&dirty[j];j++)
+			bufs[j-i]=SlotData(run[j]);
+		if(j>i)
+		{
+			block_write_multiple(fs_device,Slot(run[i])->SecNo,bufs,j-i);
+			lock_acquire(&StatLock);
+			WriteBacks+=j-i;
+			WriteRequests++;
+			lock_release(&StatLock);
+		}
+	}
 }
-void hit_count(int n)
+/* Releases and unpins the CNT slots in RUN. */
+static void end_run(const int run[],int cnt)
 {
 	int i;
-	for(i=0;i<CacheSize;i++)
-		if(cache[i].Use==true)
-			cache[i].Num++;
-	cache[n].Num=0;
+	for(i=0;i<cnt;i++)
+	{
+		rw_release(&Slot(run[i])->Rw);
+		unpin(run[i]);
+	}
+}
+void cache_close(void)
+{
+	flush_dirty(true);
 }
 void write_back_all(void)
+{
+	flush_dirty(true);
+}
+/* Marks slot N dirty.  Caller must hold the slot's Rw for
+   writing. */
+static void mark_dirty(int n)
+{
+	lock_acquire(&DirtyLock);
+	if(!Slot(n)->Dirty)
+	{
+		Slot(n)->Dirty=true;
+		DirtyCnt++;
+		if(DirtyCnt*100>DirtyBg*capacity())
+			kick_flusher();
+	}
+	lock_release(&DirtyLock);
+}
+/* Blocks the calling writer while more than DirtyMax percent of
+   the cache is dirty, a flush at a time.  The writer may still
+   hold other sectors, which the flusher skips, so waiting for the
+   dirty share to fall further could wait forever. */
+static void throttle_writer(void)
+{
+	if(lock_held_by_current_thread(&FlushLock))
+		return;
+	lock_acquire(&DirtyLock);
+	while(DirtyCnt*100>DirtyMax*capacity())
+	{
+		unsigned gen=FlushGen;
+		kick_flusher();
+		while(FlushGen==gen)
+			cond_wait(&DirtyCond,&DirtyLock);
+	}
+	lock_release(&DirtyLock);
+}
+/* Orders flush entries by sector. */
+static int sec_order(const void *a,const void *b)
+{
+	block_sector_t x=((const struct FlushEntry *)a)->SecNo;
+	block_sector_t y=((const struct FlushEntry *)b)->SecNo;
+	return x<y?-1:x>y;
+}
+/* Writes every dirty slot back in ascending sector order, so the
+   disk sees one sweep instead of slot-order seeks, with runs of
+   consecutive sectors going out as one request each.  Unless WAIT
+   is true, slots that some thread holds for writing are skipped
+   rather than waited for. */
+static void flush_dirty(bool wait)
+{
+	int run[RunMax],len=0;
+	int i,cnt=0;
+	lock_acquire(&FlushLock);
+	if(FlushHook!=NULL)
+		FlushHook();
+	lock_acquire(&CacheLock);
+	for(i=0;i<slot_cnt();i++)
+		if(Slot(i)->Use&&Slot(i)->Dirty)
+		{
+			FlushOrder[cnt].Slot=i;
+			FlushOrder[cnt].SecNo=Slot(i)->SecNo;
+			cnt++;
+		}
+	lock_release(&CacheLock);
+	qsort(FlushOrder,cnt,sizeof *FlushOrder,sec_order);
+	for(i=0;i<cnt;i++)
+	{
+		int n=FlushOrder[i].Slot;
+		block_sector_t sector=FlushOrder[i].SecNo;
+		if(len>0&&(len==RunMax||sector!=Slot(run[len-1])->SecNo+1))
+		{
+			write_run(run,len);
+			end_run(run,len);
+			len=0;
+		}
+		/* The slot may have been evicted (and so written back),
+		   or even handed back to palloc, since the snapshot.
+		   Pinning it while it is written keeps it in place. */
+		if(!pin_slot(n,sector))
+			continue;
+		if(!rw_try_acquire_read(&Slot(n)->Rw))
+		{
+			if(!wait)
+			{
+				unpin(n);
+				continue;
+			}
+			/* Don't wait with the run held. */
+			write_run(run,len);
+			end_run(run,len);
+			len=0;
+			rw_acquire_read(&Slot(n)->Rw);
+		}
+		run[len++]=n;
+	}
+	write_run(run,len);
+	end_run(run,len);
+	lock_release(&FlushLock);
+	lock_acquire(&DirtyLock);
+	FlushGen++;
+	cond_broadcast(&DirtyCond,&DirtyLock);
+	lock_release(&DirtyLock);
+}
+/* Wakes the flusher, unless it is already due to run.  Caller
+   must hold DirtyLock. */
+static void kick_flusher(void)
+{
+	if(!FlushKick)
+	{
+		FlushKick=true;
+		sema_up(&FlushSema);
+	}
+}
+/* Write-behind thread.  Blocks until kicked by mark_dirty(),
+   throttle_writer(), shrink_chunk() or flush_ticker().  It may
+   be holding up a writer that holds other sectors, so it doesn't
+   wait for sectors being written. */
+static void flusher(void *aux UNUSED)
+{
+	for(;;)
+	{
+		sema_down(&FlushSema);
+		lock_acquire(&DirtyLock);
+		FlushKick=false;
+		lock_release(&DirtyLock);
+		flush_dirty(false);
+	}
+}
+/* Kicks the flusher every FlushPeriod milliseconds, or every tick
+   if that is shorter.  timer_sleep() blocks the thread in
+   between. */
+static void flush_ticker(void *aux UNUSED)
+{
+	int64_t period=(int64_t)FlushPeriod*TIMER_FREQ/1000;
+	if(period<1)
+		period=1;
+	for(;;)
+	{
+		timer_sleep(period);
+		lock_acquire(&DirtyLock);
+		kick_flusher();
+		lock_release(&DirtyLock);
+	}
+}
+
+/* LRU: slots are kept on LruList from most to least recently
+   used, so a hit moves one slot to the front and the victim is
+   always the back. */
+static struct list LruList;
+static void lru_init(void)
+{
+	list_init(&LruList);
+}
+static void lru_insert(int n)
+{
+	list_push_front(&LruList,&Slot(n)->LruElem);
+}
+static void lru_hit(int n)
+{
+	list_remove(&Slot(n)->LruElem);
+	list_push_front(&LruList,&Slot(n)->LruElem);
+}
+static void lru_remove(int n)
+{
+	list_remove(&Slot(n)->LruElem);
+}
+static int lru_victim(void)
+{
+	return oldest_evictable(&LruList);
+}
+/* Returns the evictable slot nearest the back of LIST, which
+   holds slots by LruElem, or -1 if there is none. */
+static int oldest_evictable(struct list *list)
+{
+	struct list_elem *e;
+	for(e=list_rbegin(list);e!=list_rend(list);e=list_prev(e))
+	{
+		int n=list_entry(e,struct Cache,LruElem)->Idx;
+		if(evictable(n))
+			return n;
+	}
+	return -1;
+}
+
+/* Clock (second chance): a hit only sets the slot's reference
+   bit.  The hand sweeps the slots, clearing set bits, and stops
+   at the first slot whose bit is already clear. */
+static int ClockHand;
+static void clock_init(void)
+{
+	ClockHand=0;
+}
+static void clock_insert(int n)
+{
+	Slot(n)->Ref=true;
+}
+static void clock_hit(int n)
+{
+	Slot(n)->Ref=true;
+}
+static void clock_remove(int n)
+{
+	Slot(n)->Ref=false;
+}
+static int clock_victim(void)
+{
+	int i;
+	/* Two sweeps are enough: the first clears every bit it passes. */
+	for(i=0;i<2*slot_cnt();i++)
+	{
+		int n=ClockHand;
+		ClockHand=(ClockHand+1)%slot_cnt();
+		if(!evictable(n))
+			continue;
+		if(!Slot(n)->Ref)
+			return n;
+		Slot(n)->Ref=false;
+	}
+	return -1;
+}
+
+/* 2Q: a sector seen for the first time goes on A1in, a FIFO kept
+   to a quarter of the cache.  When it leaves A1in only its sector
+   number is kept, on the A1out ghost list, which remembers half a
+   cache worth of sectors.  A miss on a sector still on A1out shows
+   it is used again and again, so it goes on Am, an LRU list that
+   a long sequential pass can't flush: the pass's sectors are each
+   used once and never get past A1in. */
+struct Ghost
+{
+	block_sector_t SecNo;
+	struct hash_elem HashElem;	//element of GhostIndex
+	struct list_elem Elem;	//element of GhostList or GhostFree
+};
+static struct list A1in,Am;
+static int A1inCnt;
+static struct Ghost *Ghosts;	//room for the largest A1out
+static struct list GhostList;	//A1out, newest first
+static struct list GhostFree;	//unused Ghosts
+static struct hash GhostIndex;	//sector number to its Ghost
+static int GhostCnt;	//length of GhostList
+static unsigned ghost_hash(const struct hash_elem *e,void *aux UNUSED)
+{
+	return hash_int(hash_entry(e,struct Ghost,HashElem)->SecNo);
+}
+static bool ghost_less(const struct hash_elem *a,const struct hash_elem *b,void *aux UNUSED)
+{
+	return hash_entry(a,struct Ghost,HashElem)->SecNo<hash_entry(b,struct Ghost,HashElem)->SecNo;
+}
+static void twoq_init(void)
+{
+	int i,max=ChunkMax*SecsPerPage/2;
+	list_init(&A1in);
+	list_init(&Am);
+	list_init(&GhostList);
+	list_init(&GhostFree);
+	A1inCnt=GhostCnt=0;
+	Ghosts=malloc(max*sizeof *Ghosts);
+	if(Ghosts==NULL||!hash_init(&GhostIndex,ghost_hash,ghost_less,NULL))
+		PANIC("can't allocate 2q ghost list");
+	for(i=0;i<max;i++)
+		list_push_back(&GhostFree,&Ghosts[i].Elem);
+}
+/* Remembers SECTOR on A1out, forgetting the oldest ghost if A1out
+   is full. */
+static void ghost_add(block_sector_t sector)
+{
+	struct Ghost *g;
+	while(GhostCnt>0&&GhostCnt>=capacity()/2)
+	{
+		g=list_entry(list_pop_back(&GhostList),struct Ghost,Elem);
+		hash_delete(&GhostIndex,&g->HashElem);
+		list_push_front(&GhostFree,&g->Elem);
+		GhostCnt--;
+	}
+	if(list_empty(&GhostFree))
+		return;
+	g=list_entry(list_pop_front(&GhostFree),struct Ghost,Elem);
+	g->SecNo=sector;
+	hash_insert(&GhostIndex,&g->HashElem);
+	list_push_front(&GhostList,&g->Elem);
+	GhostCnt++;
+}
+/* Forgets SECTOR if it is on A1out.  Returns true if it was. */
+static bool ghost_take(block_sector_t sector)
+{
+	struct Ghost key,*g;
+	struct hash_elem *e;
+	key.SecNo=sector;
+	e=hash_delete(&GhostIndex,&key.HashElem);
+	if(e==NULL)
+		return false;
+	g=hash_entry(e,struct Ghost,HashElem);
+	list_remove(&g->Elem);
+	list_push_front(&GhostFree,&g->Elem);
+	GhostCnt--;
+	return true;
+}
+static void twoq_insert(int n)
+{
+	Slot(n)->Hot=ghost_take(Slot(n)->SecNo);
+	if(Slot(n)->Hot)
+		list_push_front(&Am,&Slot(n)->LruElem);
+	else
+	{
+		list_push_front(&A1in,&Slot(n)->LruElem);
+		A1inCnt++;
+	}
+}
+/* Hits on A1in are left alone: a burst of accesses to a sector
+   just read in is one use, not proof of a hot sector. */
+static void twoq_hit(int n)
+{
+	if(Slot(n)->Hot)
+	{
+		list_remove(&Slot(n)->LruElem);
+		list_push_front(&Am,&Slot(n)->LruElem);
+	}
+}
+static void twoq_remove(int n)
+{
+	list_remove(&Slot(n)->LruElem);
+	if(!Slot(n)->Hot)
+	{
+		A1inCnt--;
+		ghost_add(Slot(n)->SecNo);
+	}
+}
+static int twoq_victim(void)
+{
+	int n=-1;
+	if(A1inCnt>capacity()/4)
+		n=oldest_evictable(&A1in);
+	if(n==-1)
+		n=oldest_evictable(&Am);
+	if(n==-1)
+		n=oldest_evictable(&A1in);
+	return n;
+}
+
+/* Queues SECTOR to be read into the cache in the background.
+   Never blocks; the request is dropped if the queue is full. */
+void cache_readahead(block_sector_t sector)
+{
+	lock_acquire(&AheadLock);
+	if(AheadCnt<AheadQueueSize)
+	{
+		AheadQueue[(AheadHead+AheadCnt)%AheadQueueSize]=sector;
+		AheadCnt++;
+		sema_up(&AheadSema);
+	}
+	lock_release(&AheadLock);
+}
+/* Records a sequential read of SECTOR in the read-ahead
+   statistics.  Returns true if SECTOR is already cached, meaning
+   read-ahead kept up with the reader. */
+bool cache_readahead_hit(block_sector_t sector)
+{
+	bool hit=in_cache(sector)!=-1;
+	lock_acquire(&AheadLock);
+	if(hit)
+		AheadHits++;
+	else
+		AheadMisses++;
+	lock_release(&AheadLock);
+	return hit;
+}
+/* Read-ahead thread.  Loads queued sectors that aren't cached
+   yet, flagging them so an unread eviction can be counted. */
+static void read_ahead(void *aux UNUSED)
+{
+	for(;;)
+	{
+		block_sector_t sector;
+		sema_down(&AheadSema);
+		lock_acquire(&AheadLock);
+		sector=AheadQueue[AheadHead];
+		AheadHead=(AheadHead+1)%AheadQueueSize;
+		AheadCnt--;
+		lock_release(&AheadLock);
+		if(in_cache(sector)==-1)
+		{
+			int n=Fetch(sector,true,true);
+			rw_release(&Slot(n)->Rw);
+			unpin(n);
+		}
+	}
+}
+/* Acquires LOCK, counting a lock wait if it is busy. */
+static void acquire(struct lock *lock)
+{
+	if(lock_try_acquire(lock))
+		return;
+	lock_acquire(lock);
+	lock_acquire(&StatLock);
+	LockWaits++;
+	lock_release(&StatLock);
+}
+/* Acquires slot N's Rw for writing if WRITE is true or for
+   reading if not, counting a slot wait if that means waiting. */
+static void acquire_slot(int n,bool write)
+{
+	struct rwlock *rw=&Slot(n)->Rw;
+	if(write?rw_try_acquire_write(rw):rw_try_acquire_read(rw))
+		return;
+	if(write)
+		rw_acquire_write(rw);
+	else
+		rw_acquire_read(rw);
+	lock_acquire(&StatLock);
+	SlotWaits++;
+	lock_release(&StatLock);
+}
+/* Returns the CPU's cycle counter. */
+static inline unsigned long long rdtsc(void)
+{
+	unsigned lo,hi;
+	asm volatile("rdtsc":"=a"(lo),"=d"(hi));
+	return (unsigned long long)hi<<32|lo;
+}
+/* Adds a read miss that took CYCLES to the latency histogram. */
+static void count_miss(unsigned long long cycles)
+{
+	int i=0;
+	while(i<CACHE_LATENCY_BUCKETS-1&&cycles>=1ULL<<(i+CACHE_LATENCY_SHIFT))
+		i++;
+	lock_acquire(&StatLock);
+	MissLatency[i]++;
+	lock_release(&StatLock);
+}
+/* Copies the cache statistics into STATS. */
+void cache_get_stats(struct cache_stats *stats)
+{
+	lock_acquire(&CacheLock);
+	stats->hits=Hits[0];
+	stats->misses=Misses[0];
+	stats->meta_hits=Hits[1];
+	stats->meta_misses=Misses[1];
+	stats->evictions=Evictions;
+	stats->sectors=capacity();
+	stats->max_sectors=ChunkMax*SecsPerPage;
+	lock_acquire(&StatLock);
+	stats->write_backs=WriteBacks;
+	stats->write_requests=WriteRequests;
+	stats->lock_waits=LockWaits;
+	stats->slot_waits=SlotWaits;
+	memcpy(stats->miss_latency,MissLatency,sizeof MissLatency);
+	lock_release(&StatLock);
+	lock_release(&CacheLock);
+}
+/* Prints KIND's hit ratio, to a tenth of a percent, and after
+   it SEP. */
+static void print_ratio(const char *kind,unsigned long long hits,unsigned long long misses,const char *sep)
+{
+	unsigned long long total=hits+misses;
+	unsigned permille=total?hits*1000/total:0;
+	printf("%s %u.%u%% of %llu%s",kind,permille/10,permille%10,total,sep);
+}
+/* Prints buffer cache statistics. */
+void cache_print_stats(void)
 {
 	int i;
-	for(i=0;i<CacheSize;i++)
-		if(cache[i].Use==true&&cache[i].Dirty==true)
-			write_back(i);
-}
\ No newline at end of file
+	printf("Cache %s hit ratio: ",CurPolicy->Name);
+	print_ratio("all",Hits[0]+Hits[1],Misses[0]+Misses[1],", ");
+	print_ratio("data",Hits[0],Misses[0],", ");
+	print_ratio("metadata",Hits[1],Misses[1],"\n");
+	printf("Cache: %d of at most %d sectors, %llu pages reclaimed\n",
+		capacity(),ChunkMax*SecsPerPage,PagesReclaimed);
+	printf("Cache read-ahead: %llu hits, %llu misses, %llu wasted\n",
+		AheadHits,AheadMisses,AheadWasted);
+	printf("Cache: %llu evictions, %llu write-backs in %llu requests, %llu lock waits, %llu slot waits\n",
+		Evictions,WriteBacks,WriteRequests,LockWaits,SlotWaits);
+	printf("Cache miss latency (cycles):");
+	for(i=0;i<CACHE_LATENCY_BUCKETS;i++)
+		if(MissLatency[i]!=0)
+		{
+			if(i<CACHE_LATENCY_BUCKETS-1)
+				printf(" <2^%d %llu",i+CACHE_LATENCY_SHIFT,MissLatency[i]);
+			else
+				printf(" more %llu",MissLatency[i]);
+		}
+	printf("\n");
+}
@@ -4,18 +4,35 @@
 #include<string.h>
 #include"threads/malloc.h"
 #include"filesys/filesys.h"
-#define CacheSize 64 //64 sectors used 32KB 8Pages
+#define CacheMinSize 64 //sectors always kept; more are allocated on demand
 #include"devices/block.h"
+#include<cache-stats.h>
+/* Flags for cache_get(). */
+#define CACHE_META 1 //sector holds metadata, for the statistics
+#define CACHE_WRITE 2 //caller may change the data
 extern unsigned int PassTime;
 extern bool Inited;
 void cache_init(void);
+void cache_set_policy(const char *name);
+void cache_set_flush_period(int ms);
+void cache_set_dirty_bg(int pct);
+void cache_set_dirty_max(int pct);
+void cache_set_max(int sectors);
+void cache_set_flush_hook(void (*hook)(void));
 void cache_read(block_sector_t sector,void *buffer);
+void cache_read_meta(block_sector_t sector,void *buffer);
 void cache_write(block_sector_t,const void *buffer);
-int Fetch(block_sector_t sector);
+void cache_zero(block_sector_t sector);
+void *cache_get(block_sector_t sector,int *handle,int flags);
+void cache_put(int handle,bool dirty);
+int Fetch(block_sector_t sector,bool read,bool ahead);
 int in_cache(block_sector_t sector);
 int Evict(void);
 void write_back(int n);
 void cache_close(void);
-void hit_count(int n);
 void write_back_all(void);
+void cache_readahead(block_sector_t sector);
+bool cache_readahead_hit(block_sector_t sector);
+void cache_get_stats(struct cache_stats *stats);
+void cache_print_stats(void);
 #endif
\ No newline at end of file
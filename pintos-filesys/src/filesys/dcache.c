@@ -0,0 +1,189 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers what looking up a name in a directory found: the
+   sector of the named file's inode, or 0 if the directory has no
+   such name.  That lets path resolution skip the directory's
+   data, and its index, for names it has looked up lately, even
+   ones that turned out not to exist.
+
+   directory.c invalidates an entry whenever it adds or removes
+   the name, with the directory's DIR_LOCK held exclusively, and
+   looks up and inserts entries with it held shared, so what the
+   cache says about a directory never disagrees with the
+   directory for a thread holding its DIR_LOCK. */
+
+/* Number of entries cached.  The least recently used one is
+   replaced. */
+#define DCACHE_SIZE 256
+
+/* A cached lookup. */
+struct dentry
+  {
+    struct hash_elem elem;              /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    bool in_use;                        /* In dentries? */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name looked up. */
+    block_sector_t sector;              /* Inode found, or 0 if none. */
+  };
+
+static struct dentry dentry_pool[DCACHE_SIZE];
+
+/* Cached lookups, keyed by directory and name. */
+static struct hash dentries;
+
+/* Every entry in dentry_pool, most recently used first.  Unused
+   ones are at the back. */
+static struct list lru_list;
+
+/* Guards all of the above. */
+static struct lock dcache_lock;
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, elem);
+  return hash_int (d->dir) ^ hash_string (d->name);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the entry for NAME in directory DIR, or a null pointer
+   if there is none.  Caller must hold dcache_lock. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.elem);
+  return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Drops entry D.  Caller must hold dcache_lock. */
+static void
+drop (struct dentry *d)
+{
+  hash_delete (&dentries, &d->elem);
+  d->in_use = false;
+  list_remove (&d->lru_elem);
+  list_push_back (&lru_list, &d->lru_elem);
+}
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("can't allocate directory entry cache");
+  list_init (&lru_list);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      dentry_pool[i].in_use = false;
+      list_push_back (&lru_list, &dentry_pool[i].lru_elem);
+    }
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in directory DIR in the cache.  If it is there,
+   returns true and sets *SECTORP to the sector of its inode, or
+   to 0 if DIR has no file by that name.  Otherwise returns
+   false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      *sectorp = d->sector;
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in directory DIR has its inode in SECTOR, or
+   doesn't exist if SECTOR is 0. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      d = list_entry (list_back (&lru_list), struct dentry, lru_elem);
+      if (d->in_use)
+        hash_delete (&dentries, &d->elem);
+      d->in_use = true;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->elem);
+    }
+  d->sector = sector;
+  list_remove (&d->lru_elem);
+  list_push_front (&lru_list, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets NAME in directory DIR, which is being added or
+   removed. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    drop (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name in directory DIR, which is being removed, so
+   that a directory that reuses its sector doesn't inherit them. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    if (dentry_pool[i].in_use && dentry_pool[i].dir == dir)
+      drop (&dentry_pool[i]);
+  lock_release (&dcache_lock);
+}
@@ -1,10 +1,341 @@
 #include "filesys/directory.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+
+/* A directory that grows to this many entry slots gets a hash
+   index, so that looking up a name reads a bounded number of
+   sectors instead of every entry.
+
+   The index is a file of its own, apart from the directory's
+   entries, which stay plain dir_entry records for
+   dir_readdir().  Its first sector is a header, and the rest are
+   buckets.  Bucket B holds the entries whose names' hashes have B
+   in their low bits, and when one fills up, every bucket is split
+   in two by the next bit of the hash, as in ext3's htree and
+   extendible hashing.
+
+   Changes to the index happen with the directory's DIR_LOCK held
+   exclusively, and lookups hold it shared, so they never see a
+   bucket in the middle of a split. */
+#define INDEX_MIN_ENTRIES 64
+
+/* Most buckets an index may have. */
+#define INDEX_MAX_BUCKETS 4096
+
+/* Identifies an index header. */
+#define INDEX_MAGIC 0x58444e49
+
+/* Entries in a bucket. */
+#define BUCKET_SLOTS 63
+
+/* Header of a directory's hash index.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct index_header
+  {
+    uint32_t magic;                     /* INDEX_MAGIC. */
+    uint32_t bucket_cnt;                /* Number of buckets, a power of 2. */
+    uint32_t partial;                   /* Nonzero if entries are missing. */
+    uint32_t free_hint;                 /* No free slot comes before it. */
+    uint32_t unused[124];               /* Not used. */
+  };
+
+/* An entry in the index. */
+struct index_slot
+  {
+    uint32_t hash;                      /* hash_string() of its name. */
+    uint32_t slot;                      /* Which dir_entry it is. */
+  };
+
+/* A bucket of the index.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct index_bucket
+  {
+    uint32_t cnt;                       /* Number of slots[] in use. */
+    uint32_t unused;                    /* Not used. */
+    struct index_slot slots[BUCKET_SLOTS];
+  };
+
+/* Returns the offset of bucket B in an index. */
+static off_t
+bucket_ofs (uint32_t b)
+{
+  return (off_t) (b + 1) * BLOCK_SECTOR_SIZE;
+}
+
+/* Opens the hash index of the directory in INODE, or returns a
+   null pointer if it has none. */
+static struct inode *
+index_open (struct inode *inode)
+{
+  block_sector_t sector = inode_get_index (inode);
+  return sector != 0 ? inode_open (sector) : NULL;
+}
+
+/* Reads the header fields of INDEX from MAGIC through FREE_HINT
+   into *H.  Returns false if INDEX doesn't look right. */
+static bool
+read_header (struct inode *index, struct index_header *h)
+{
+  off_t size = offsetof (struct index_header, unused);
+  return (inode_read_at (index, h, size, 0) == size
+          && h->magic == INDEX_MAGIC
+          && h->bucket_cnt > 0
+          && (h->bucket_cnt & (h->bucket_cnt - 1)) == 0);
+}
+
+/* Sets the FIELD of INDEX's header to VALUE. */
+static void
+write_header_field (struct inode *index, size_t field, uint32_t value)
+{
+  inode_write_at (index, &value, sizeof value, field);
+}
+
+/* Writes empty buckets FIRST through LAST - 1 into INDEX, so that
+   filling them later never needs a new sector.  Returns false if
+   the disk is full or memory runs out. */
+static bool
+clear_buckets (struct inode *index, uint32_t first, uint32_t last)
+{
+  struct index_bucket *bk = calloc (1, sizeof *bk);
+  bool ok = bk != NULL;
+
+  for (; ok && first < last; first++)
+    ok = (inode_write_at (index, bk, sizeof *bk, bucket_ofs (first))
+          == sizeof *bk);
+  free (bk);
+  return ok;
+}
+
+/* Doubles the number of buckets in INDEX, splitting each bucket
+   B into B and B + the old count.  Returns false, leaving INDEX
+   as it was, if it can't grow. */
+static bool
+index_grow (struct inode *index)
+{
+  struct index_header h;
+  struct index_bucket *old, *lo, *hi;
+  uint32_t b, i;
+  bool ok = false;
+
+  if (!read_header (index, &h) || h.bucket_cnt >= INDEX_MAX_BUCKETS)
+    return false;
+  old = malloc (sizeof *old);
+  lo = malloc (sizeof *lo);
+  hi = malloc (sizeof *hi);
+  if (old == NULL || lo == NULL || hi == NULL
+      || !clear_buckets (index, h.bucket_cnt, h.bucket_cnt * 2))
+    goto done;
+
+  /* Fill the new buckets before emptying the old ones, so that
+     an entry is always in one of them. */
+  for (b = 0; b < h.bucket_cnt; b++)
+    {
+      inode_read_at (index, old, sizeof *old, bucket_ofs (b));
+      memset (lo, 0, sizeof *lo);
+      memset (hi, 0, sizeof *hi);
+      for (i = 0; i < old->cnt; i++)
+        {
+          struct index_bucket *to = (old->slots[i].hash & h.bucket_cnt
+                                     ? hi : lo);
+          to->slots[to->cnt++] = old->slots[i];
+        }
+      inode_write_at (index, hi, sizeof *hi, bucket_ofs (b + h.bucket_cnt));
+      inode_write_at (index, lo, sizeof *lo, bucket_ofs (b));
+    }
+  write_header_field (index, offsetof (struct index_header, bucket_cnt),
+                      h.bucket_cnt * 2);
+  ok = true;
+
+ done:
+  free (old);
+  free (lo);
+  free (hi);
+  return ok;
+}
+
+/* Adds entry SLOT of a directory, whose name hashes to HASH, to
+   the directory's INDEX.  If it won't fit, marks INDEX partial
+   instead. */
+static void
+index_insert (struct inode *index, uint32_t hash, uint32_t slot)
+{
+  struct index_bucket *bk = malloc (sizeof *bk);
+  struct index_header h;
+
+  while (bk != NULL && read_header (index, &h))
+    {
+      off_t ofs = bucket_ofs (hash & (h.bucket_cnt - 1));
+      inode_read_at (index, bk, sizeof *bk, ofs);
+      if (bk->cnt < BUCKET_SLOTS)
+        {
+          bk->slots[bk->cnt].hash = hash;
+          bk->slots[bk->cnt].slot = slot;
+          bk->cnt++;
+          inode_write_at (index, bk, sizeof *bk, ofs);
+          free (bk);
+          return;
+        }
+      if (!index_grow (index))
+        break;
+    }
+  free (bk);
+  write_header_field (index, offsetof (struct index_header, partial), 1);
+}
+
+/* Removes entry SLOT of a directory, whose name hashes to HASH,
+   from the directory's INDEX.  Entries the index still has for
+   removed names do no harm, since lookups check the name, so
+   this gives up if memory runs out. */
+static void
+index_delete (struct inode *index, uint32_t hash, uint32_t slot)
+{
+  struct index_bucket *bk = malloc (sizeof *bk);
+  struct index_header h;
+  uint32_t i;
+
+  if (bk != NULL && read_header (index, &h))
+    {
+      off_t ofs = bucket_ofs (hash & (h.bucket_cnt - 1));
+      inode_read_at (index, bk, sizeof *bk, ofs);
+      for (i = 0; i < bk->cnt; i++)
+        if (bk->slots[i].hash == hash && bk->slots[i].slot == slot)
+          {
+            bk->slots[i] = bk->slots[--bk->cnt];
+            inode_write_at (index, bk, sizeof *bk, ofs);
+            break;
+          }
+      if (slot < h.free_hint)
+        write_header_field (index,
+                            offsetof (struct index_header, free_hint), slot);
+    }
+  free (bk);
+}
+
+/* Looks up NAME in INDEX, the hash index of DIR, reading only the
+   entries with NAME's hash.  Returns true and sets *EP and *OFSP
+   as lookup() does if it finds NAME.  Otherwise returns false,
+   setting *COMPLETE to true if NAME really isn't in DIR, or to
+   false if INDEX couldn't tell. */
+static bool
+index_find (const struct dir *dir, struct inode *index, const char *name,
+            struct dir_entry *ep, off_t *ofsp, bool *complete)
+{
+  uint32_t hash = hash_string (name);
+  struct index_bucket *bk = malloc (sizeof *bk);
+  struct index_header h;
+  uint32_t i;
+
+  *complete = false;
+  if (bk == NULL || !read_header (index, &h))
+    {
+      free (bk);
+      return false;
+    }
+  inode_read_at (index, bk, sizeof *bk,
+                 bucket_ofs (hash & (h.bucket_cnt - 1)));
+  for (i = 0; i < bk->cnt && i < BUCKET_SLOTS; i++)
+    if (bk->slots[i].hash == hash)
+      {
+        struct dir_entry e;
+        off_t ofs = (off_t) bk->slots[i].slot * sizeof e;
+
+        if (inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+            && e.in_use && !strcmp (name, e.name))
+          {
+            if (ep != NULL)
+              *ep = e;
+            if (ofsp != NULL)
+              *ofsp = ofs;
+            free (bk);
+            return true;
+          }
+      }
+  *complete = !h.partial;
+  free (bk);
+  return false;
+}
+
+/* Returns true if a directory without a hash index that has just
+   grown to SLOT_CNT entry slots should get one.  That is when it
+   reaches INDEX_MIN_ENTRIES, and then each time it doubles, in
+   case building the index failed for lack of disk space or
+   memory, rather than on every addition after. */
+static bool
+index_due (size_t slot_cnt)
+{
+  return slot_cnt >= INDEX_MIN_ENTRIES && (slot_cnt & (slot_cnt - 1)) == 0;
+}
+
+/* Gives DIR, whose DIR_LOCK the caller holds exclusively, a hash
+   index of its entries.  Leaves DIR without one if the disk is
+   full or memory runs out. */
+static void
+index_build (struct dir *dir)
+{
+  struct index_header *h;
+  struct inode *index;
+  struct dir_entry e;
+  block_sector_t sector;
+  uint32_t bucket_cnt = 1;
+  uint32_t slot, free_hint;
+  size_t slot_cnt = inode_length (dir->inode) / sizeof e;
+
+  /* Start half full. */
+  while (bucket_cnt * BUCKET_SLOTS < slot_cnt * 2
+         && bucket_cnt < INDEX_MAX_BUCKETS)
+    bucket_cnt *= 2;
+
+  if (!free_map_allocate (inode_get_inumber (dir->inode), 1, &sector))
+    return;
+  if (!inode_create (sector, bucket_ofs (bucket_cnt)))
+    {
+      free_map_release (sector, 1);
+      return;
+    }
+  index = inode_open (sector);
+  h = calloc (1, sizeof *h);
+  if (index == NULL || h == NULL
+      || !clear_buckets (index, 0, bucket_cnt))
+    goto fail;
+  h->magic = INDEX_MAGIC;
+  h->bucket_cnt = bucket_cnt;
+  if (inode_write_at (index, h, sizeof *h, 0) != sizeof *h)
+    goto fail;
+
+  free_hint = slot_cnt;
+  for (slot = 0; inode_read_at (dir->inode, &e, sizeof e,
+                                (off_t) slot * sizeof e) == sizeof e;
+       slot++)
+    if (e.in_use)
+      index_insert (index, hash_string (e.name), slot);
+    else if (slot < free_hint)
+      free_hint = slot;
+  write_header_field (index, offsetof (struct index_header, free_hint),
+                      free_hint);
+
+  inode_set_index (dir->inode, sector);
+  inode_close (index);
+  free (h);
+  return;
+
+ fail:
+  if (index != NULL)
+    {
+      inode_remove (index);
+      inode_close (index);
+    }
+  else
+    free_map_release (sector, 1);
+  free (h);
+}
 
 
 /* Creates a directory with space for ENTRY_CNT entries in the
@@ -79,11 +410,23 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
+  struct inode *index;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  index = index_open (dir->inode);
+  if (index != NULL)
+    {
+      bool complete;
+      bool found = index_find (dir, index, name, ep, ofsp, &complete);
+
+      inode_close (index);
+      if (found || complete)
+        return found;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
   {
@@ -104,20 +447,32 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Names looked up lately are found in the dentry cache, without
+   reading DIR. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t parent, sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  /* Holding the lock until the inode is open keeps dir_remove()
+     from removing it, and the reclaim thread from freeing its
+     sector for reuse, in between, whether the sector came from
+     the dentry cache or from DIR. */
+  parent = inode_get_inumber (dir->inode);
+  rw_acquire_read (&dir->inode->dir_lock);
+  if (!dcache_lookup (parent, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+      dcache_insert (parent, name, sector);
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
+  rw_release (&dir->inode->dir_lock);
 
   return *inode != NULL;
 }
@@ -126,13 +481,17 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), DIR has been removed,
+   or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  block_sector_t parent, sector;
   struct dir_entry e;
-  off_t ofs;
+  struct inode *index = NULL;
+  struct index_header h;
+  off_t ofs = 0;
+  bool grew;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -142,29 +501,53 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that NAME is not in use, holding the lock so nobody
+     adds it meanwhile.  With the lock held, the dentry cache is
+     up to date for DIR. */
+  parent = inode_get_inumber (dir->inode);
+  rw_acquire_write (&dir->inode->dir_lock);
+  if (dir->inode->removed)
+    goto done;
+  if (dcache_lookup (parent, name, &sector)
+      ? sector != 0 : lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
+     current end-of-file.  An index knows where to start looking.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  index = index_open (dir->inode);
+  if (index != NULL && read_header (index, &h))
+    ofs = (off_t) h.free_hint * sizeof e;
+  for (; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (!e.in_use)
       break;
 
   /* Write slot. */
+  grew = ofs == inode_length (dir->inode);
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_invalidate (parent, name);
+
+  if (success && index != NULL)
+    {
+      index_insert (index, hash_string (name), ofs / sizeof e);
+      write_header_field (index, offsetof (struct index_header, free_hint),
+                          ofs / sizeof e + 1);
+    }
+  else if (success && grew && index_due (ofs / sizeof e + 1))
+    index_build (dir);
 
  done:
+  inode_close (index);
+  rw_release (&dir->inode->dir_lock);
   return success;
 }
 
@@ -193,17 +576,27 @@ dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  struct inode *index;
   bool success = false;
+  bool locked = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  rw_acquire_write (&dir->inode->dir_lock);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
-  /* Open inode. */
+  /* Open inode.  A directory's own lock keeps entries from being
+     added to it until it is marked removed; parents are always
+     locked before their children. */
   inode = inode_open (e.inode_sector);
+  if (inode != NULL && inode->data.isdir)
+    {
+      rw_acquire_write (&inode->dir_lock);
+      locked = true;
+    }
   if (inode == NULL || inode->data.isdir && inode->open_cnt > 1)
     if (inode == NULL || !is_empty(inode))
       goto done;
@@ -212,12 +605,24 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  if (inode->data.isdir)
+    dcache_invalidate_dir (inode_get_inumber (inode));
+  index = index_open (dir->inode);
+  if (index != NULL)
+    {
+      index_delete (index, hash_string (name), ofs / sizeof e);
+      inode_close (index);
+    }
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (locked)
+    rw_release (&inode->dir_lock);
+  rw_release (&dir->inode->dir_lock);
   inode_close (inode);
   return success;
 }
@@ -244,7 +649,6 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 
 struct dir *path_open(char *path,int *pos)
 {
-  lock_acquire(&DirOpenLock);
   struct dir *dir=dir_open_root();
   struct inode *inode=NULL;
   int cur=0,i,n;
@@ -264,10 +668,8 @@ struct dir *path_open(char *path,int *pos)
       cur=i+1;
     }
   *pos=cur;
-  lock_release(&DirOpenLock);
   return dir;
 
 end:
-  lock_release(&DirOpenLock);
   return NULL;
 }
\ No newline at end of file
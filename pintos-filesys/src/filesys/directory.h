@@ -45,6 +45,5 @@ bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
 struct dir *path_open(char *path,int *pos);
-struct lock DirOpenLock;
 
 #endif /* filesys/directory.h */
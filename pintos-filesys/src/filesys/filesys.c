@@ -7,6 +7,7 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -23,8 +24,10 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dcache_init ();
   free_map_init ();
   cache_init();
+  cache_set_flush_hook (free_map_flush);
 
   if (format) 
     do_format ();
@@ -37,6 +40,8 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_release_preallocs ();
+  inode_reclaim ();
   cache_close();
   free_map_close ();
 }
@@ -54,7 +59,9 @@ filesys_create (const char *name, off_t initial_size)
   copy_to(tpath,name);
   struct dir *dir = path_open (name, &pos);
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate (inode_get_inumber
+                                          (dir_get_inode (dir)),
+                                        1, &inode_sector)
                   && inode_create (inode_sector, initial_size)
                   && dir_add (dir, name+pos, inode_sector));
   if (!success && inode_sector != 0) 
@@ -107,10 +114,12 @@ filesys_remove (const char *name)
 static void
 do_format (void)
 {
-  printf ("Formatting file system...");
+  printf ("Formatting file system, %zu block groups of %d sectors...",
+          free_map_group_cnt (), BLOCK_GROUP_SECTORS);
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
-  printf ("done.\n");
+  printf ("done, free space in a %s.\n",
+          free_map_has_extents () ? "free-extent tree" : "bitmap");
 }
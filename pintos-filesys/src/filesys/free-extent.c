@@ -0,0 +1,439 @@
+#include "filesys/free-extent.h"
+#include <debug.h>
+#include "threads/malloc.h"
+
+/* Free-extent tree.
+
+   Keeps the free sectors of the disk as extents, maximal runs of
+   free sectors, each of which is a node of two AVL trees at once.
+   The BY_START tree orders them by first sector, and each node
+   also records the longest extent in its subtree, so the first
+   extent at or after a given sector that is long enough for a
+   request is found by one descent.  The BY_LENGTH tree orders them
+   by length and then first sector, so the shortest extent that is
+   long enough (the best fit) is found by another.  Both take time
+   logarithmic in the number of extents.  Freed sectors merge with
+   the extents on either side.
+
+   The module does no locking: free-map.c calls it only while
+   holding its free_map_lock. */
+
+/* Trees. */
+enum { BY_START, BY_LENGTH };
+
+/* Sides of a node. */
+enum { LEFT, RIGHT };
+
+/* A free extent. */
+struct free_extent
+  {
+    block_sector_t start;               /* First free sector. */
+    size_t length;                      /* Number of free sectors. */
+    struct free_extent *child[2][2];    /* Children, by tree and side. */
+    int height[2];                      /* Height of subtree, by tree. */
+    size_t max_length;                  /* Longest in BY_START subtree. */
+  };
+
+static struct free_extent *roots[2];    /* Root of each tree. */
+static size_t extent_cnt;               /* Number of extents. */
+
+/* Returns the height of E's subtree in tree T. */
+static inline int
+height (int t, const struct free_extent *e)
+{
+  return e != NULL ? e->height[t] : 0;
+}
+
+/* Returns true if A comes before B in tree T. */
+static bool
+precedes (int t, const struct free_extent *a, const struct free_extent *b)
+{
+  if (t == BY_LENGTH && a->length != b->length)
+    return a->length < b->length;
+  return a->start < b->start;
+}
+
+/* Recomputes what E records about its subtree in tree T from its
+   children. */
+static void
+update (int t, struct free_extent *e)
+{
+  struct free_extent *l = e->child[t][LEFT];
+  struct free_extent *r = e->child[t][RIGHT];
+
+  e->height[t] = (height (t, l) > height (t, r)
+                  ? height (t, l) : height (t, r)) + 1;
+  if (t == BY_START)
+    {
+      e->max_length = e->length;
+      if (l != NULL && l->max_length > e->max_length)
+        e->max_length = l->max_length;
+      if (r != NULL && r->max_length > e->max_length)
+        e->max_length = r->max_length;
+    }
+}
+
+/* Rotates the subtree of tree T rooted at E toward SIDE and
+   returns its new root. */
+static struct free_extent *
+rotate (int t, struct free_extent *e, int side)
+{
+  struct free_extent *c = e->child[t][!side];
+
+  e->child[t][!side] = c->child[t][side];
+  c->child[t][side] = e;
+  update (t, e);
+  update (t, c);
+  return c;
+}
+
+/* Restores the AVL balance of the subtree of tree T rooted at E,
+   whose own subtrees are balanced, and returns its new root. */
+static struct free_extent *
+rebalance (int t, struct free_extent *e)
+{
+  int side;
+
+  update (t, e);
+  if (height (t, e->child[t][LEFT]) > height (t, e->child[t][RIGHT]) + 1)
+    side = LEFT;
+  else if (height (t, e->child[t][RIGHT]) > height (t, e->child[t][LEFT]) + 1)
+    side = RIGHT;
+  else
+    return e;
+
+  /* E leans to SIDE.  If that child leans the other way, straighten
+     it out first. */
+  {
+    struct free_extent *c = e->child[t][side];
+    if (height (t, c->child[t][!side]) > height (t, c->child[t][side]))
+      e->child[t][side] = rotate (t, c, side);
+  }
+  return rotate (t, e, !side);
+}
+
+/* Inserts E into the subtree of tree T rooted at ROOT and returns
+   its new root. */
+static struct free_extent *
+insert (int t, struct free_extent *root, struct free_extent *e)
+{
+  int side;
+
+  if (root == NULL)
+    {
+      e->child[t][LEFT] = e->child[t][RIGHT] = NULL;
+      update (t, e);
+      return e;
+    }
+  side = precedes (t, e, root) ? LEFT : RIGHT;
+  root->child[t][side] = insert (t, root->child[t][side], e);
+  return rebalance (t, root);
+}
+
+/* Removes the first extent from the nonempty subtree of tree T
+   rooted at ROOT, stores it in *FIRST, and returns the subtree's
+   new root. */
+static struct free_extent *
+erase_first (int t, struct free_extent *root, struct free_extent **first)
+{
+  if (root->child[t][LEFT] == NULL)
+    {
+      *first = root;
+      return root->child[t][RIGHT];
+    }
+  root->child[t][LEFT] = erase_first (t, root->child[t][LEFT], first);
+  return rebalance (t, root);
+}
+
+/* Removes E from the subtree of tree T rooted at ROOT, which must
+   contain it, and returns the subtree's new root. */
+static struct free_extent *
+erase (int t, struct free_extent *root, struct free_extent *e)
+{
+  struct free_extent *next, *right;
+
+  ASSERT (root != NULL);
+  if (root != e)
+    {
+      int side = precedes (t, e, root) ? LEFT : RIGHT;
+      root->child[t][side] = erase (t, root->child[t][side], e);
+      return rebalance (t, root);
+    }
+  if (e->child[t][RIGHT] == NULL)
+    return e->child[t][LEFT];
+  right = erase_first (t, e->child[t][RIGHT], &next);
+  next->child[t][LEFT] = e->child[t][LEFT];
+  next->child[t][RIGHT] = right;
+  return rebalance (t, next);
+}
+
+/* Adds E to both trees. */
+static void
+link_extent (struct free_extent *e)
+{
+  roots[BY_START] = insert (BY_START, roots[BY_START], e);
+  roots[BY_LENGTH] = insert (BY_LENGTH, roots[BY_LENGTH], e);
+}
+
+/* Removes E from both trees.  E's start and length must not have
+   changed since it was added. */
+static void
+unlink_extent (struct free_extent *e)
+{
+  roots[BY_START] = erase (BY_START, roots[BY_START], e);
+  roots[BY_LENGTH] = erase (BY_LENGTH, roots[BY_LENGTH], e);
+}
+
+/* Returns the last extent that starts before SECTOR, or a null
+   pointer if there is none. */
+static struct free_extent *
+find_before (block_sector_t sector)
+{
+  struct free_extent *e = roots[BY_START], *found = NULL;
+
+  while (e != NULL)
+    if (e->start < sector)
+      {
+        found = e;
+        e = e->child[BY_START][RIGHT];
+      }
+    else
+      e = e->child[BY_START][LEFT];
+  return found;
+}
+
+/* Returns the first extent that starts at or after SECTOR, or a
+   null pointer if there is none. */
+static struct free_extent *
+find_from (block_sector_t sector)
+{
+  struct free_extent *e = roots[BY_START], *found = NULL;
+
+  while (e != NULL)
+    if (e->start >= sector)
+      {
+        found = e;
+        e = e->child[BY_START][LEFT];
+      }
+    else
+      e = e->child[BY_START][RIGHT];
+  return found;
+}
+
+/* Returns the first extent in the BY_START subtree rooted at E
+   that starts at or after SECTOR and is at least CNT sectors
+   long, or a null pointer if there is none.  Subtrees without an
+   extent that long are skipped whole. */
+static struct free_extent *
+first_fit (struct free_extent *e, block_sector_t sector, size_t cnt)
+{
+  while (e != NULL && e->max_length >= cnt)
+    {
+      if (e->start >= sector)
+        {
+          struct free_extent *found = first_fit (e->child[BY_START][LEFT],
+                                                 sector, cnt);
+          if (found != NULL)
+            return found;
+          if (e->length >= cnt)
+            return e;
+        }
+      e = e->child[BY_START][RIGHT];
+    }
+  return NULL;
+}
+
+/* Returns the shortest extent at least CNT sectors long, the one
+   that starts first among equals, or a null pointer if there is
+   none. */
+static struct free_extent *
+best_fit (size_t cnt)
+{
+  struct free_extent *e = roots[BY_LENGTH], *found = NULL;
+
+  while (e != NULL)
+    if (e->length >= cnt)
+      {
+        found = e;
+        e = e->child[BY_LENGTH][LEFT];
+      }
+    else
+      e = e->child[BY_LENGTH][RIGHT];
+  return found;
+}
+
+/* Frees the subtree of BY_START rooted at E. */
+static void
+destroy (struct free_extent *e)
+{
+  if (e != NULL)
+    {
+      destroy (e->child[BY_START][LEFT]);
+      destroy (e->child[BY_START][RIGHT]);
+      free (e);
+    }
+}
+
+/* Forgets all the free extents. */
+void
+free_extent_clear (void)
+{
+  destroy (roots[BY_START]);
+  roots[BY_START] = roots[BY_LENGTH] = NULL;
+  extent_cnt = 0;
+}
+
+/* Records the CNT sectors starting at START, none of which may
+   be free already, as free, merging them with the extents just
+   before and after them.  Returns false if memory for a new
+   extent could not be allocated, in which case nothing changes. */
+bool
+free_extent_add (block_sector_t start, size_t cnt)
+{
+  struct free_extent *prev = find_before (start);
+  struct free_extent *next = find_from (start);
+
+  ASSERT (cnt > 0);
+  ASSERT (prev == NULL || prev->start + prev->length <= start);
+  ASSERT (next == NULL || start + cnt <= next->start);
+
+  if (prev != NULL && prev->start + prev->length == start)
+    {
+      unlink_extent (prev);
+      prev->length += cnt;
+      if (next != NULL && start + cnt == next->start)
+        {
+          unlink_extent (next);
+          prev->length += next->length;
+          free (next);
+          extent_cnt--;
+        }
+      link_extent (prev);
+    }
+  else if (next != NULL && start + cnt == next->start)
+    {
+      unlink_extent (next);
+      next->start = start;
+      next->length += cnt;
+      link_extent (next);
+    }
+  else
+    {
+      struct free_extent *e = malloc (sizeof *e);
+      if (e == NULL)
+        return false;
+      e->start = start;
+      e->length = cnt;
+      link_extent (e);
+      extent_cnt++;
+    }
+  return true;
+}
+
+/* Takes the CNT sectors starting at SECTOR out of extent E, which
+   must hold them.  SPARE is used for the part of E after them if
+   a part is left on both sides; otherwise it is freed. */
+static void
+take (struct free_extent *e, block_sector_t sector, size_t cnt,
+      struct free_extent *spare)
+{
+  size_t before = sector - e->start;
+  size_t after = e->start + e->length - (sector + cnt);
+
+  unlink_extent (e);
+  if (before > 0)
+    {
+      e->length = before;
+      link_extent (e);
+    }
+  else if (after > 0)
+    {
+      e->start = sector + cnt;
+      e->length = after;
+      link_extent (e);
+    }
+  else
+    {
+      free (e);
+      extent_cnt--;
+    }
+  if (before > 0 && after > 0)
+    {
+      spare->start = sector + cnt;
+      spare->length = after;
+      link_extent (spare);
+      extent_cnt++;
+    }
+  else
+    free (spare);
+}
+
+/* Allocates CNT free sectors, storing the first into *SECTORP.
+   They are taken from sector LO on, if an extent that starts
+   before LO runs long enough past it, or else from the start of
+   the first extent long enough that starts between LO and HI.
+   Failing both, they come from the start of the best fit on the
+   whole disk.  Returns false if no extent is long enough. */
+bool
+free_extent_alloc (block_sector_t lo, block_sector_t hi, size_t cnt,
+                   block_sector_t *sectorp)
+{
+  struct free_extent *spare = malloc (sizeof *spare);
+  struct free_extent *e = find_before (lo);
+
+  ASSERT (cnt > 0);
+
+  /* Splitting an extent in two needs SPARE. */
+  if (spare != NULL && e != NULL && e->start + e->length >= lo + cnt)
+    *sectorp = lo;
+  else
+    {
+      e = first_fit (roots[BY_START], lo, cnt);
+      if (e == NULL || e->start >= hi)
+        e = best_fit (cnt);
+      if (e == NULL)
+        {
+          free (spare);
+          return false;
+        }
+      *sectorp = e->start;
+    }
+  take (e, *sectorp, cnt, spare);
+  return true;
+}
+
+/* Returns the number of free extents. */
+size_t
+free_extent_cnt (void)
+{
+  return extent_cnt;
+}
+
+/* Stores the free extents of the BY_START subtree rooted at E, in
+   order, into RANGES from *CNT on, up to MAX in all. */
+static void
+get_extents (const struct free_extent *e, struct free_range *ranges,
+             size_t *cnt, size_t max)
+{
+  if (e == NULL || *cnt >= max)
+    return;
+  get_extents (e->child[BY_START][LEFT], ranges, cnt, max);
+  if (*cnt < max)
+    {
+      ranges[*cnt].start = e->start;
+      ranges[*cnt].cnt = e->length;
+      ++*cnt;
+    }
+  get_extents (e->child[BY_START][RIGHT], ranges, cnt, max);
+}
+
+/* Stores up to MAX of the free extents, in order of first sector,
+   into RANGES, and returns the number stored. */
+size_t
+free_extent_get (struct free_range *ranges, size_t max)
+{
+  size_t cnt = 0;
+
+  get_extents (roots[BY_START], ranges, &cnt, max);
+  return cnt;
+}
@@ -0,0 +1,16 @@
+#ifndef FILESYS_FREE_EXTENT_H
+#define FILESYS_FREE_EXTENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/free-map.h"
+
+void free_extent_clear (void);
+bool free_extent_add (block_sector_t start, size_t cnt);
+bool free_extent_alloc (block_sector_t lo, block_sector_t hi, size_t cnt,
+                        block_sector_t *sectorp);
+size_t free_extent_cnt (void);
+size_t free_extent_get (struct free_range *, size_t max);
+
+#endif /* filesys/free-extent.h */
@@ -1,40 +1,344 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-extent.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Guards free_map and its file. */
+
+/* Sectors of the free map file whose part of free_map changed
+   since it was last written, one bit per sector.  Changes only
+   mark them; free_map_flush() writes them out, so a run of
+   allocations rewrites each sector once rather than the whole
+   map each time.  Guarded by free_map_lock. */
+static struct bitmap *free_map_dirty;
+
+/* Bits of free_map per sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* A file system may be formatted to allocate from a tree of free
+   extents (see free-extent.c) instead of scanning free_map.  The
+   free map file then has a table of the free extents after the
+   bitmap, from which the tree is loaded at startup, and which is
+   written back at shutdown.  The table is marked unclean while
+   the file system is in use, and free_map is still kept up to
+   date, so after a crash the tree is rebuilt from free_map. */
+static bool extent_format;           /* Free map file has a table. */
+static bool format_extents;          /* Format with a table? */
+static bool use_extents;             /* Allocate from the tree? */
+
+/* Most extents the table holds.  If there are more at shutdown,
+   the tree is rebuilt from free_map at the next startup. */
+#define EXTENT_TABLE_MAX 1024
+
+/* Identifies a free extent table. */
+#define EXTENT_TABLE_MAGIC 0x54584546
+
+/* First sector of the free extent table, followed by the extents.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_table_header
+  {
+    unsigned magic;                     /* EXTENT_TABLE_MAGIC. */
+    uint32_t clean;                     /* Written at shutdown? */
+    uint32_t cnt;                       /* Number of extents. */
+    uint32_t unused[125];               /* Not used. */
+  };
+
+/* A free extent in the table. */
+struct extent_table_entry
+  {
+    uint32_t start;                     /* First free sector. */
+    uint32_t length;                    /* Number of free sectors. */
+  };
+
+/* Selects the kind of free map that formatting the file system
+   creates: NAME is "bitmap", the default, or "extents".  Panics
+   if NAME is neither. */
+void
+free_map_set_format (const char *name)
+{
+  if (name != NULL && !strcmp (name, "bitmap"))
+    format_extents = false;
+  else if (name != NULL && !strcmp (name, "extents"))
+    format_extents = true;
+  else
+    PANIC ("unknown free map format `%s'", name != NULL ? name : "");
+}
+
+/* Returns true if the free map file has a free extent table. */
+bool
+free_map_has_extents (void)
+{
+  return extent_format;
+}
+
+/* Returns the offset in the free map file of the free extent
+   table. */
+static off_t
+table_ofs (void)
+{
+  return ROUND_UP (bitmap_file_size (free_map), BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the size of the free extent table. */
+static off_t
+table_size (void)
+{
+  return (sizeof (struct extent_table_header)
+          + EXTENT_TABLE_MAX * sizeof (struct extent_table_entry));
+}
+
+/* Stops allocating from the free-extent tree, after it failed to
+   record a free extent for lack of memory, and goes back to
+   scanning free_map.  Caller must hold free_map_lock, unless the
+   free map is not open yet. */
+static void
+drop_extents (void)
+{
+  if (use_extents)
+    {
+      printf ("free map: out of memory, allocating from bitmap\n");
+      free_extent_clear ();
+      use_extents = false;
+    }
+}
+
+/* Rebuilds the free-extent tree from free_map and starts
+   allocating from it. */
+static void
+build_extents (void)
+{
+  size_t start = 0;
+
+  free_extent_clear ();
+  use_extents = true;
+  for (;;)
+    {
+      size_t end;
+
+      start = bitmap_scan (free_map, start, 1, false);
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (free_map);
+      if (!free_extent_add (start, end - start))
+        {
+          drop_extents ();
+          break;
+        }
+      start = end;
+    }
+}
+
+/* Loads the free-extent tree from the table in the free map file.
+   Returns false, leaving the tree empty, if the table was not
+   written at a clean shutdown or does not match free_map. */
+static bool
+load_extents (void)
+{
+  struct extent_table_header *h = malloc (sizeof *h);
+  struct extent_table_entry *e = malloc (EXTENT_TABLE_MAX * sizeof *e);
+  size_t free_cnt = 0;
+  bool ok = false;
+  uint32_t i;
+
+  free_extent_clear ();
+  if (h == NULL || e == NULL
+      || file_read_at (free_map_file, h, sizeof *h, table_ofs ())
+         != sizeof *h
+      || h->magic != EXTENT_TABLE_MAGIC || !h->clean
+      || h->cnt > EXTENT_TABLE_MAX
+      || (file_read_at (free_map_file, e, h->cnt * sizeof *e,
+                        table_ofs () + sizeof *h)
+          != (off_t) (h->cnt * sizeof *e)))
+    goto done;
+  for (i = 0; i < h->cnt; i++)
+    {
+      if (e[i].length == 0
+          || e[i].start + e[i].length > bitmap_size (free_map)
+          || bitmap_any (free_map, e[i].start, e[i].length)
+          || (i > 0 && e[i - 1].start + e[i - 1].length >= e[i].start)
+          || !free_extent_add (e[i].start, e[i].length))
+        goto done;
+      free_cnt += e[i].length;
+    }
+  ok = free_cnt == bitmap_count (free_map, 0, bitmap_size (free_map), false);
+
+ done:
+  if (!ok)
+    free_extent_clear ();
+  free (e);
+  free (h);
+  return ok;
+}
+
+/* Writes the free extent table header, with CLEAN as its clean
+   flag, and, if CLEAN is true, the extents from the tree. */
+static void
+write_extents (bool clean)
+{
+  struct extent_table_header *h = calloc (1, sizeof *h);
+  struct extent_table_entry *e = NULL;
+  struct free_range *ranges = NULL;
+  size_t i, cnt = 0;
+
+  if (h == NULL)
+    PANIC ("can't write free extent table");
+  if (clean)
+    {
+      e = malloc (EXTENT_TABLE_MAX * sizeof *e);
+      ranges = malloc (EXTENT_TABLE_MAX * sizeof *ranges);
+      lock_acquire (&free_map_lock);
+      clean = (use_extents && e != NULL && ranges != NULL
+               && free_extent_cnt () <= EXTENT_TABLE_MAX);
+      if (clean)
+        cnt = free_extent_get (ranges, EXTENT_TABLE_MAX);
+      lock_release (&free_map_lock);
+      for (i = 0; i < cnt; i++)
+        {
+          e[i].start = ranges[i].start;
+          e[i].length = ranges[i].cnt;
+        }
+      if (clean
+          && (file_write_at (free_map_file, e, cnt * sizeof *e,
+                             table_ofs () + sizeof *h)
+              != (off_t) (cnt * sizeof *e)))
+        PANIC ("can't write free extent table");
+    }
+  h->magic = EXTENT_TABLE_MAGIC;
+  h->clean = clean;
+  h->cnt = cnt;
+  if (file_write_at (free_map_file, h, sizeof *h, table_ofs ())
+      != sizeof *h)
+    PANIC ("can't write free extent table");
+  free (ranges);
+  free (e);
+  free (h);
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  size_t summary_size;
+  void *summary;
+
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  summary_size = bitmap_summary_size (block_size (fs_device));
+  summary = malloc (summary_size);
+  if (summary == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  bitmap_summarize (free_map, summary, summary_size);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
+}
+
+/* Marks the sectors of the free map file that hold the bits for
+   the CNT sectors starting at SECTOR dirty.  Caller must hold
+   free_map_lock. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Returns the number of block groups on the disk. */
+size_t
+free_map_group_cnt (void)
+{
+  return DIV_ROUND_UP (bitmap_size (free_map), BLOCK_GROUP_SECTORS);
+}
+
+/* Prints each block group's sectors and how many are free. */
+void
+free_map_print_groups (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < free_map_group_cnt (); i++)
+    {
+      size_t start = i * BLOCK_GROUP_SECTORS;
+      size_t cnt = bitmap_size (free_map) - start;
+
+      if (cnt > BLOCK_GROUP_SECTORS)
+        cnt = BLOCK_GROUP_SECTORS;
+      printf ("Block group %zu: sectors %zu-%zu, %zu free.\n",
+              i, start, start + cnt - 1,
+              bitmap_count (free_map, start, cnt, false));
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The lowest free run in the block
+   group of sector GOAL is taken if there is one.  Failing that,
+   with a bitmap, the run is the next fit: the search starts where
+   the last run taken this way ended and wraps around to the start
+   of the disk, so a full stretch of disk isn't scanned again on
+   each allocation.  With a free-extent tree, the run comes from
+   the best fit on the disk instead.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  If no run is free while removed files
+   are still waiting for their sectors to be reclaimed, reclaims
+   them and tries again. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (block_sector_t goal, size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t group_start = goal / BLOCK_GROUP_SECTORS * BLOCK_GROUP_SECTORS;
+  size_t group_end;
+  block_sector_t sector;
+
+  if (group_start >= bitmap_size (free_map))
+    group_start = 0;
+  group_end = group_start + BLOCK_GROUP_SECTORS;
+  if (group_end > bitmap_size (free_map))
+    group_end = bitmap_size (free_map);
+  do
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      lock_acquire (&free_map_lock);
+      if (use_extents)
+        {
+          if (!free_extent_alloc (group_start, group_end, cnt, &sector))
+            sector = BITMAP_ERROR;
+          ASSERT (sector == BITMAP_ERROR
+                  || bitmap_none (free_map, sector, cnt));
+          if (sector != BITMAP_ERROR)
+            bitmap_set_multiple (free_map, sector, cnt, true);
+        }
+      else
+        {
+          sector = bitmap_scan_and_flip_before (free_map, group_start,
+                                                group_end, cnt, false);
+          if (sector == BITMAP_ERROR)
+            sector = bitmap_scan_and_flip_next (free_map, cnt, false);
+        }
+      if (sector != BITMAP_ERROR)
+        mark_dirty (sector, cnt);
+      lock_release (&free_map_lock);
     }
+  while (sector == BITMAP_ERROR && free_map_file != NULL && inode_reclaim ());
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
@@ -44,12 +348,65 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  if (use_extents && !free_extent_add (sector, cnt))
+    drop_extents ();
+  lock_release (&free_map_lock);
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Makes the CNT sector runs RANGES available for use, taking
+   free_map_lock once for all of them. */
+void
+free_map_release_ranges (const struct free_range *ranges, size_t cnt)
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (bitmap_all (free_map, ranges[i].start, ranges[i].cnt));
+      bitmap_set_multiple (free_map, ranges[i].start, ranges[i].cnt, false);
+      mark_dirty (ranges[i].start, ranges[i].cnt);
+      if (use_extents && !free_extent_add (ranges[i].start, ranges[i].cnt))
+        drop_extents ();
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file that changed since
+   they were last written.  Each goes out holding free_map_lock,
+   so it is never written with a change half made.  This is the
+   buffer cache's flush hook, so it runs at the start of each
+   write-back and the free map reaches the disk along with the
+   data it describes; other callers should use write_back_all(). */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    {
+      lock_acquire (&free_map_lock);
+      if (free_map_file != NULL && bitmap_test (free_map_dirty, i))
+        {
+          bitmap_reset (free_map_dirty, i);
+          if (!bitmap_write_part (free_map, free_map_file,
+                                  i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+            PANIC ("can't write free map");
+        }
+      lock_release (&free_map_lock);
+    }
+}
+
+/* Opens the free map file and reads it from disk.  If it has a
+   free extent table, loads the free-extent tree from it, or
+   rebuilds the tree from the bitmap if the file system was not
+   shut down cleanly, and marks the table unclean until it is. */
 void
 free_map_open (void) 
 {
@@ -58,28 +415,81 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
+
+  extent_format = file_length (free_map_file) > table_ofs ();
+  use_extents = false;
+  if (extent_format)
+    {
+      if (load_extents ())
+        use_extents = true;
+      else
+        {
+          printf ("free map: rebuilding free extents from bitmap\n");
+          build_extents ();
+        }
+      write_extents (false);
+    }
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  if (extent_format)
+    write_extents (true);
+  write_back_all ();
+  lock_acquire (&free_map_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
-   it. */
+   it, with room for a free extent table after it if
+   free_map_set_format() selected one. */
 void
 free_map_create (void) 
 {
+  struct file *file;
+  off_t size = bitmap_file_size (free_map);
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (format_extents)
+    size = table_ofs () + table_size ();
+  if (!inode_create (FREE_MAP_SECTOR, size))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The file has no sectors yet, and
+     allocating them must not write the free map to the file
+     again, so the first write is made before free_map_file is
+     set.  The second one records the file's own sectors. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  if (format_extents)
+    {
+      /* Allocate the table's sectors now, so that writing it at
+         shutdown doesn't change the free map. */
+      void *zeros = calloc (1, table_size ());
+      if (zeros == NULL
+          || file_write_at (file, zeros, table_size (), table_ofs ())
+             != table_size ())
+        PANIC ("can't write free extent table");
+      free (zeros);
+    }
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
+
+  extent_format = format_extents;
+  use_extents = false;
+  if (extent_format)
+    build_extents ();
 }
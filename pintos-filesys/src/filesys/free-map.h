@@ -10,8 +10,28 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
 
-bool free_map_allocate (size_t, block_sector_t *);
+/* The disk is divided into block groups of this many sectors.
+   Sectors are allocated in the block group of a related sector
+   if there is room, to keep seeks between them short. */
+#define BLOCK_GROUP_SECTORS 1024
+
+void free_map_set_format (const char *name);
+bool free_map_has_extents (void);
+size_t free_map_group_cnt (void);
+void free_map_print_groups (void);
+
+bool free_map_allocate (block_sector_t goal, size_t, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
 
+/* A run of CNT sectors starting at START. */
+struct free_range
+  {
+    block_sector_t start;
+    size_t cnt;
+  };
+
+void free_map_release_ranges (const struct free_range *, size_t);
+
 #endif /* filesys/free-map.h */
@@ -7,11 +7,13 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
-/* List files in the root directory. */
+/* List files in the root directory, then the block groups and
+   the free space left in each. */
 void
 fsutil_ls (char **argv UNUSED) 
 {
@@ -25,6 +27,7 @@ fsutil_ls (char **argv UNUSED)
   while (dir_readdir (dir, name))
     printf ("%s\n", name);
   dir_close (dir);
+  free_map_print_groups ();
   printf ("End of listing.\n");
 }
 
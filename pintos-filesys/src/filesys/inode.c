@@ -1,27 +1,54 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/cache.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
-#define direct (12*512)
-#define indirect1 (direct+128*512)
-#define indirect2 (indirect1+128*128*512)
-#define indirect3 (indirect2+128*128*128*512)
 
-struct PosInfo
-{
-  uint16_t lev;
-  uint32_t off;
+/* Identifies an extent block. */
+#define EXTENT_MAGIC 0x45585442
+
+/* Entries in an extent block. */
+#define EXTENTS_PER_BLOCK 42
+
+/* A node of an inode's extent tree below the root, which is in
+   the inode.  Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Every node keeps its entries sorted by BLOCK.  A node at depth
+   0, a leaf, holds the extents themselves; the others hold index
+   entries for the nodes one level down.  The tree grows at the
+   root: when the inode has no room left for another entry, its
+   entries move into a new extent block and it keeps a single
+   index entry for that block. */
+struct extent_block
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t cnt;                       /* Entries used in extents[]. */
+    struct extent extents[EXTENTS_PER_BLOCK];
+  };
 
-  uint32_t sn[4];
-  uint32_t np[4];
-};
+static void map_cache_clear (struct inode *);
+static void prealloc_release (struct inode *);
+
+/* Bounds of the preallocation window, in sectors. */
+#define PREALLOC_MIN 8
+#define PREALLOC_MAX 128
+
+/* Sector runs gathered before writing the free map once for all
+   of them. */
+#define RECLAIM_BATCH 64
+
+/* Bounds of the read-ahead window, in sectors. */
+#define RA_MIN 2
+#define RA_MAX 32
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -33,45 +60,103 @@ bytes_to_sectors (off_t size)
 
 
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Guards open_inodes and the open_cnt of every open inode. */
+static struct lock open_inodes_lock;
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Returns the open inode for SECTOR, or a null pointer if SECTOR
+   is not open.  Caller must hold open_inodes_lock. */
+static struct inode *
+find_open (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Sector runs waiting to be given back to the free map. */
+struct release_batch
+  {
+    size_t cnt;                         /* Entries used in ranges[]. */
+    struct free_range ranges[RECLAIM_BATCH];
+  };
+
+/* Removed inodes whose last opener has closed them, in order,
+   waiting for the reclaim thread to free their sectors.  Their
+   sectors stay allocated until then, so none of them can be
+   reused early. */
+static struct list reclaim_list;
+
+/* Guards reclaim_list and reclaim_pending. */
+static struct lock reclaim_lock;
+
+/* Inodes queued and not yet given back to the free map. */
+static size_t reclaim_pending;
+
+/* Counts inodes queued for the reclaim thread. */
+static struct semaphore reclaim_sema;
+
+/* One reclamation at a time, guards reclaim_batch. */
+static struct lock reclaim_run_lock;
+static struct release_batch reclaim_batch;
+
+static void reclaimer (void *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate open inode table");
+  lock_init (&open_inodes_lock);
+  list_init (&reclaim_list);
+  lock_init (&reclaim_lock);
+  reclaim_pending = 0;
+  sema_init (&reclaim_sema, 0);
+  lock_init (&reclaim_run_lock);
+  reclaim_batch.cnt = 0;
+  thread_create ("inode-reclaim", PRI_DEFAULT, reclaimer, NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  No data sectors are allocated: a file of at most
+   INODE_INLINE_MAX bytes keeps its data in the inode, and a
+   larger one starts out as one hole, which reads as zeros, with
+   sectors allocated as parts of it are written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool inode_create(block_sector_t sector,off_t length)
 {
   return inode_create_extend(sector,length,0);
 }
 
+/* Like inode_create(), but makes a directory if ISDIR is 1. */
 bool inode_create_extend (block_sector_t sector, off_t length,uint32_t isdir)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
 
   ASSERT (length >= 0);
 
@@ -80,31 +165,16 @@ bool inode_create_extend (block_sector_t sector, off_t length,uint32_t isdir)
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-  {
-    size_t sectors = bytes_to_sectors (length);
-    disk_inode->length = length;
-    disk_inode->isdir=isdir;
-    disk_inode->magic = INODE_MAGIC;
-    for(int i=0;i<BLOCK_NUM;i++)    
-      disk_inode->blocks[i]=0;
-    success=true;
-    static char zeros[BLOCK_SECTOR_SIZE];
-    struct inode ie;
-    ie.deny_write_cnt=0;
-    ie.data=*disk_inode;
-    ie.open_cnt=0;
-    for (int i = 0; i < sectors; i++)
-    {
-      size_t  minb=length<512?length:512;
-      inode_write_at(&ie,zeros,minb,i*512);  
-      length-=512;             
-    } 
-    *disk_inode=ie.data;
-    cache_write (sector, disk_inode); 
-    free (disk_inode);
-  }
-  return success;
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->length = length;
+  disk_inode->isdir = isdir;
+  disk_inode->magic = INODE_MAGIC;
+  if (length <= INODE_INLINE_MAX)
+    disk_inode->flags = INODE_INLINE;
+  cache_write (sector, disk_inode);
+  free (disk_inode);
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -113,33 +183,51 @@ bool inode_create_extend (block_sector_t sector, off_t length,uint32_t isdir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *open;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  lock_acquire (&open_inodes_lock);
+  inode = find_open (sector);
+  if (inode != NULL)
+    inode->open_cnt++;
+  lock_release (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, reading the inode without the lock held. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  cache_read (inode->sector, &inode->data);
+  inode->ra_next = 0;
+  inode->ra_end = 0;
+  inode->ra_window = RA_MIN;
+  rw_init (&inode->rw);
+  lock_init (&inode->lock);
+  rw_init (&inode->dir_lock);
+  inode->pre_cnt = 0;
+  inode->pre_window = PREALLOC_MIN;
+  map_cache_clear (inode);
+  cache_read_meta (inode->sector, &inode->data);
+
+  /* Another thread may have opened it meanwhile. */
+  lock_acquire (&open_inodes_lock);
+  open = find_open (sector);
+  if (open != NULL)
+    open->open_cnt++;
+  else
+    hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (open != NULL)
+    {
+      free (inode);
+      return open;
+    }
   return inode;
 }
 
@@ -148,7 +236,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -159,90 +251,182 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Gives the sectors in BATCH back to the free map. */
+static void
+batch_flush (struct release_batch *batch)
+{
+  free_map_release_ranges (batch->ranges, batch->cnt);
+  batch->cnt = 0;
+}
+
+/* Adds the CNT sectors from START to BATCH, extending its last
+   run if they follow it, and flushes BATCH when it fills up. */
+static void
+batch_add (struct release_batch *batch, block_sector_t start, size_t cnt)
+{
+  struct free_range *last = batch->ranges + batch->cnt;
+
+  if (batch->cnt > 0 && last[-1].start + last[-1].cnt == start)
+    last[-1].cnt += cnt;
+  else
+    {
+      if (batch->cnt == RECLAIM_BATCH)
+        batch_flush (batch);
+      batch->ranges[batch->cnt].start = start;
+      batch->ranges[batch->cnt].cnt = cnt;
+      batch->cnt++;
+    }
+}
+
+/* Adds the sectors mapped by the CNT entries E of an extent tree
+   node at DEPTH, and at depths above 0 the extent blocks below
+   it too, to BATCH.  An extent block goes in after the blocks it
+   maps, so it can't be reused while it is still being read. */
+static void
+free_extents (const struct extent *e, uint32_t cnt, uint32_t depth,
+              struct release_batch *batch)
+{
+  uint32_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (depth > 0)
+      {
+        int h;
+        struct extent_block *b = cache_get (e[i].start, &h, CACHE_META);
+        ASSERT (b->magic == EXTENT_MAGIC);
+        free_extents (b->extents, b->cnt, depth - 1, batch);
+        cache_put (h, false);
+        batch_add (batch, e[i].start, 1);
+      }
+    else
+      batch_add (batch, e[i].start, e[i].length);
+}
+
+/* Adds the sectors of the inode in SECTOR, which nobody has open,
+   and the inode itself to BATCH. */
+static void
+free_inode (block_sector_t sector, struct release_batch *batch)
+{
+  int h;
+  const struct inode_disk *d = cache_get (sector, &h, CACHE_META);
+
+  ASSERT (d->magic == INODE_MAGIC);
+  if (!(d->flags & INODE_INLINE))
+    free_extents (d->extents, d->extent_cnt, d->depth, batch);
+  cache_put (h, false);
+  batch_add (batch, sector, 1);
+}
+
+/* Frees the sectors of every inode queued for reclamation, then
+   the inodes themselves, writing the free map once for each
+   RECLAIM_BATCH runs of sectors rather than once per run.
+   Returns false if there was nothing to reclaim. */
+bool
+inode_reclaim (void)
+{
+  size_t done = 0;
+
+  /* Reading reclaim_pending without the lock is fine: a caller
+     that races with inode_close() has nothing to wait for yet. */
+  if (reclaim_pending == 0)
+    return false;
+  lock_acquire (&reclaim_run_lock);
+  lock_acquire (&reclaim_lock);
+  while (!list_empty (&reclaim_list))
+    {
+      struct inode *inode = list_entry (list_pop_front (&reclaim_list),
+                                        struct inode, reclaim_elem);
+      lock_release (&reclaim_lock);
+      if (!(inode->data.flags & INODE_INLINE))
+        free_extents (inode->data.extents, inode->data.extent_cnt,
+                      inode->data.depth, &reclaim_batch);
+      if (inode->data.isdir && inode->data.dir_index != 0)
+        free_inode (inode->data.dir_index, &reclaim_batch);
+      batch_add (&reclaim_batch, inode->sector, 1);
+      free (inode);
+      done++;
+      lock_acquire (&reclaim_lock);
+    }
+  lock_release (&reclaim_lock);
+  batch_flush (&reclaim_batch);
+
+  lock_acquire (&reclaim_lock);
+  reclaim_pending -= done;
+  lock_release (&reclaim_lock);
+  lock_release (&reclaim_run_lock);
+  return true;
+}
+
+/* The reclaim thread, which frees removed inodes' sectors in the
+   background so that closing them doesn't wait for it. */
+static void
+reclaimer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&reclaim_sema);
+      inode_reclaim ();
+    }
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If INODE was also a removed inode, queues it for the reclaim
+   thread, which frees its blocks and then its memory. */
 
 void
 inode_close (struct inode *inode)
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      prealloc_release (inode);
 
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
-      int i;
-      for(i=0;i<12;i++)
-        if(inode->data.blocks[i]!=0)
-          free_map_release(inode->data.blocks[i],1);
-      if(inode->data.blocks[12]!=0)
-      {
-        unsigned *arr=(unsigned *)malloc(512);
-        ASSERT(arr!=NULL);
-        cache_read(inode->data.blocks[12],arr);
-        int j;
-        for(j=0;j<128&&arr[j]!=0;j++)
-            free_map_release(arr[j],1);
-        free(arr);
-        free_map_release(inode->data.blocks[12],1);
-      }
-      if(inode->data.blocks[13]!=0)
-      {
-        unsigned *arr=(unsigned *)malloc(512);
-        unsigned *brr=(unsigned *)malloc(512);
-        ASSERT(arr!=NULL&&brr!=NULL)
-        cache_read(inode->data.blocks[13],arr);
-        int j,k;
-        for(j=0;j<128&&arr[j]!=0;j++)
-        {
-          cache_read(arr[j],brr);
-          for(k=0;k<128&&brr[k]!=0;k++)
-              free_map_release(brr[k],1); 
-          free_map_release(arr[j],1);
+          lock_acquire (&reclaim_lock);
+          list_push_back (&reclaim_list, &inode->reclaim_elem);
+          reclaim_pending++;
+          lock_release (&reclaim_lock);
+          sema_up (&reclaim_sema);
         }
-        free_map_release(inode->data.blocks[13],1);
-        free(arr);
-        free(brr);
-      }
-      if(inode->data.blocks[14]!=0)
-      {
-        unsigned *arr=(unsigned *)malloc(512);
-        unsigned *brr=(unsigned *)malloc(512);
-        unsigned *crr=(unsigned *)malloc(512);
-        ASSERT(arr!=0&&brr!=0&&crr!=0);
-        cache_read(inode->data.blocks[14],arr);
-        int j,k,l;
-        for(j=0;j<128&&arr[j]!=0;j++)
-        {
-          cache_read(arr[j],brr);
-          
-            for(k=0;k<128&&brr[k]!=0;k++)
-            {
-              cache_read(brr[k],crr);
-              for(l=0;l<128&&crr[l]!=0;l++)
-                free_map_release(crr[l],1);
-              free_map_release(brr[k],1);
-            }
-          
-          free_map_release(arr[j],1);
-        }
-        free_map_release(inode->data.blocks[14],1);
-        free(arr);
-        free(brr);
-        free(crr);
-      }
-    free_map_release(inode->sector,1);
+      else
+        free (inode);
     }
-      free (inode);
+}
+
+/* Gives back the sectors preallocated for every open inode.
+   Called at shutdown, before the free map is written for the last
+   time, since inodes still open then, like a process's working
+   directory, never get to release them in inode_close(). */
+void
+inode_release_preallocs (void)
+{
+  struct hash_iterator i;
+
+  lock_acquire (&open_inodes_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+
+      rw_acquire_write (&inode->rw);
+      prealloc_release (inode);
+      rw_release (&inode->rw);
     }
+  lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -251,7 +435,506 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  rw_acquire_write (&inode->rw);
   inode->removed = true;
+  map_cache_clear (inode);
+  rw_release (&inode->rw);
+}
+
+/* Returns the index of the last of the CNT sorted entries E that
+   starts at or before file block BLK, or 0 if none does. */
+static uint32_t
+find_entry (const struct extent *e, uint32_t cnt, size_t blk)
+{
+  uint32_t lo = 0, hi = cnt;
+
+  while (hi - lo > 1)
+    {
+      uint32_t mid = (lo + hi) / 2;
+      if (e[mid].block <= blk)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Forgets the runs and the leaf remembered by INODE's block-map
+   lookup cache, whose extent tree has changed. */
+static void
+map_cache_clear (struct inode *inode)
+{
+  int i;
+
+  lock_acquire (&inode->lock);
+  for (i = 0; i < MAP_CACHE_SIZE; i++)
+    inode->map[i].length = 0;
+  inode->map_next = 0;
+  inode->map_leaf = 0;
+  lock_release (&inode->lock);
+}
+
+/* Returns the sector holding file block BLK of INODE, or 0 if
+   that block has no sector allocated, and stores in *RUN how many
+   blocks from BLK on are stored in the sectors after it, or how
+   many are unallocated too.  Only the extent blocks on the path
+   to BLK are looked at, so one call covers a whole extent.
+   Caller must hold INODE's rw.
+
+   The runs found are remembered in INODE's block-map lookup
+   cache, and so is the last leaf looked in, along with the file
+   blocks it maps, so that lookups near recent ones skip the walk
+   down the tree. */
+static block_sector_t
+lookup_run (struct inode *inode, size_t blk, size_t *run)
+{
+  const struct extent *e = inode->data.extents;
+  uint32_t cnt = inode->data.extent_cnt;
+  uint32_t depth = inode->data.depth;
+  size_t lo = 0;                        /* Range the node maps. */
+  size_t limit = (uint32_t) -1;
+  block_sector_t leaf = 0;
+  struct extent *m;
+  block_sector_t sector = 0;
+  uint32_t i = 0;
+  int h = -1;
+
+  lock_acquire (&inode->lock);
+  for (i = 0; i < MAP_CACHE_SIZE; i++)
+    {
+      m = &inode->map[i];
+      if (blk >= m->block && blk - m->block < m->length)
+        {
+          *run = m->length - (blk - m->block);
+          sector = m->start != 0 ? m->start + (blk - m->block) : 0;
+          lock_release (&inode->lock);
+          return sector;
+        }
+    }
+  if (depth > 0 && inode->map_leaf != 0
+      && blk >= inode->map_leaf_lo && blk < inode->map_leaf_hi)
+    {
+      leaf = inode->map_leaf;
+      lo = inode->map_leaf_lo;
+      limit = inode->map_leaf_hi;
+    }
+  lock_release (&inode->lock);
+
+  if (leaf != 0)
+    {
+      /* Start at the leaf, skipping the index levels. */
+      struct extent_block *b = cache_get (leaf, &h, CACHE_META);
+      ASSERT (b->magic == EXTENT_MAGIC);
+      e = b->extents;
+      cnt = b->cnt;
+      depth = 0;
+    }
+  for (;;)
+    {
+      struct extent_block *b;
+
+      i = find_entry (e, cnt, blk);
+      if (depth == 0)
+        break;
+      if (i > 0)
+        lo = e[i].block;
+      if (i + 1 < cnt)
+        limit = e[i + 1].block;
+      leaf = e[i].start;
+      if (h != -1)
+        cache_put (h, false);
+      b = cache_get (leaf, &h, CACHE_META);
+      ASSERT (b->magic == EXTENT_MAGIC);
+      e = b->extents;
+      cnt = b->cnt;
+      depth--;
+    }
+
+  if (cnt == 0)
+    *run = limit - blk;
+  else if (blk < e[i].block)
+    *run = e[i].block - blk;
+  else if (blk < e[i].block + e[i].length)
+    {
+      sector = e[i].start + (blk - e[i].block);
+      *run = e[i].block + e[i].length - blk;
+    }
+  else
+    *run = (i + 1 < cnt ? e[i + 1].block : limit) - blk;
+  if (h != -1)
+    cache_put (h, false);
+
+  lock_acquire (&inode->lock);
+  if (leaf != 0)
+    {
+      inode->map_leaf = leaf;
+      inode->map_leaf_lo = lo;
+      inode->map_leaf_hi = limit;
+    }
+  m = &inode->map[inode->map_next];
+  inode->map_next = (inode->map_next + 1) % MAP_CACHE_SIZE;
+  m->block = blk;
+  m->start = sector;
+  m->length = *run;
+  lock_release (&inode->lock);
+  return sector;
+}
+
+/* Most extent blocks one insertion into an extent tree can need:
+   one for each level that splits, and one for the root to move
+   down into.  Enough for any tree a disk of 2**32 sectors needs. */
+#define SPLIT_MAX 16
+
+/* Extent blocks set aside before an insertion changes anything,
+   so that it can't run out of disk space half done. */
+struct split_reserve
+  {
+    block_sector_t sectors[SPLIT_MAX];  /* Allocated, not yet used. */
+    int cnt;                            /* Number of sectors[]. */
+  };
+
+/* Takes an extent block from R, storing its sector in *SECTOR,
+   and sets up B as its empty contents, for the caller to fill in
+   and cache_write(). */
+static void
+new_extent_block (struct split_reserve *r, block_sector_t *sector,
+                  struct extent_block *b)
+{
+  ASSERT (r->cnt > 0);
+  *sector = r->sectors[--r->cnt];
+  memset (b, 0, sizeof *b);
+  b->magic = EXTENT_MAGIC;
+}
+
+/* Returns the most extent blocks that adding an extent for file
+   block BLK to the tree rooted in D can need.  A node splits
+   only if it is full and the node below it split too, and the
+   root moves down into a block only if it is full. */
+static int
+splits_needed (const struct inode_disk *d, size_t blk)
+{
+  block_sector_t child = d->extents[find_entry (d->extents, d->extent_cnt,
+                                                blk)].start;
+  uint32_t level;
+  int full = 0;
+
+  ASSERT (d->depth + 1 < SPLIT_MAX);
+  for (level = 0; level < d->depth; level++)
+    {
+      int h;
+      const struct extent_block *b = cache_get (child, &h, CACHE_META);
+
+      ASSERT (b->magic == EXTENT_MAGIC);
+      full = b->cnt == EXTENTS_PER_BLOCK ? full + 1 : 0;
+      child = b->extents[find_entry (b->extents, b->cnt, blk)].start;
+      cache_put (h, false);
+    }
+  return full + (d->extent_cnt == INODE_EXTENTS);
+}
+
+/* Inserts NEW among the *CNT sorted entries E, which have room
+   for CAP.  A full node is split first, moving its upper half
+   into a new extent block from R, built in B, for which an index
+   entry is stored in *SPLIT; otherwise SPLIT->start is set to 0. */
+static void
+add_entry (struct extent *e, uint32_t *cnt, uint32_t cap,
+           struct extent new, struct extent *split, struct split_reserve *r,
+           struct extent_block *b)
+{
+  uint32_t i;
+
+  split->start = 0;
+  if (*cnt == cap)
+    {
+      uint32_t half = cap / 2;
+
+      new_extent_block (r, &split->start, b);
+      b->cnt = cap - half;
+      memcpy (b->extents, e + half, b->cnt * sizeof *e);
+      *cnt = half;
+      split->block = b->extents[0].block;
+      split->length = 0;
+      if (new.block >= split->block)
+        {
+          e = b->extents;
+          cnt = &b->cnt;
+        }
+      for (i = *cnt; i > 0 && e[i - 1].block > new.block; i--)
+        e[i] = e[i - 1];
+      e[i] = new;
+      ++*cnt;
+      cache_write (split->start, b);
+      return;
+    }
+  for (i = *cnt; i > 0 && e[i - 1].block > new.block; i--)
+    e[i] = e[i - 1];
+  e[i] = new;
+  ++*cnt;
+}
+
+/* Adds extent NEW, which must not overlap any other, to the
+   subtree whose root node at DEPTH has the *CNT entries E, with
+   room for CAP.  NEW is merged into a neighboring extent if it
+   continues it on disk.  If the node has to be split, *SPLIT
+   receives the index entry of the new node, as by add_entry(),
+   which takes new extent blocks from R.
+
+   The DEPTH + 1 blocks in BUF hold copies of the extent blocks
+   being changed, so that no cache handle is held while another
+   sector is read or written: a miss could evict a neighbor of a
+   held sector. */
+static void
+insert_extent (struct extent *e, uint32_t *cnt, uint32_t cap,
+               uint32_t depth, struct extent new, struct extent *split,
+               struct split_reserve *r, struct extent_block *buf)
+{
+  uint32_t i = find_entry (e, *cnt, new.block);
+
+  split->start = 0;
+  if (depth > 0)
+    {
+      struct extent child_split;
+      struct extent_block *b = buf;
+
+      cache_read_meta (e[i].start, b);
+      ASSERT (b->magic == EXTENT_MAGIC);
+      insert_extent (b->extents, &b->cnt, EXTENTS_PER_BLOCK,
+                     depth - 1, new, &child_split, r, buf + 1);
+      cache_write (e[i].start, b);
+      if (new.block < e[i].block)
+        e[i].block = new.block;
+      if (child_split.start != 0)
+        add_entry (e, cnt, cap, child_split, split, r, buf);
+      return;
+    }
+
+  if (*cnt > 0 && e[i].block < new.block
+      && e[i].block + e[i].length == new.block
+      && e[i].start + e[i].length == new.start)
+    {
+      /* Continues extent I, and may close the gap to the next. */
+      e[i].length += new.length;
+      if (i + 1 < *cnt && e[i + 1].block == new.block + new.length
+          && e[i + 1].start == new.start + new.length)
+        {
+          e[i].length += e[i + 1].length;
+          memmove (e + i + 1, e + i + 2, (*cnt - i - 2) * sizeof *e);
+          --*cnt;
+        }
+      return;
+    }
+  if (*cnt > 0 && e[i].block <= new.block)
+    i++;
+  if (i < *cnt && e[i].block == new.block + new.length
+      && e[i].start == new.start + new.length)
+    {
+      /* Extent I continues NEW. */
+      e[i].block = new.block;
+      e[i].start = new.start;
+      e[i].length += new.length;
+      return;
+    }
+  add_entry (e, cnt, cap, new, split, r, buf);
+}
+
+/* Records that INODE's file blocks from BLK on are stored in the
+   CNT sectors from START on, which must have been a hole, and
+   writes the inode back.  Returns false, changing nothing, if the
+   disk has no room for the extent blocks that might be needed. */
+static bool
+add_extent (struct inode *inode, size_t blk, block_sector_t start,
+            size_t cnt)
+{
+  struct inode_disk *d = &inode->data;
+  struct split_reserve r;
+  struct extent new, split;
+  struct extent_block *buf;
+  int need = splits_needed (d, blk);
+
+  /* One block of BUF for each level of the tree, once the root
+     has moved down if it is full, and one for a split leaf. */
+  buf = malloc ((d->depth + (d->extent_cnt == INODE_EXTENTS) + 1)
+                * sizeof *buf);
+  if (buf == NULL)
+    return false;
+  for (r.cnt = 0; r.cnt < need; r.cnt++)
+    if (!free_map_allocate (start, 1, &r.sectors[r.cnt]))
+      {
+        while (r.cnt > 0)
+          free_map_release (r.sectors[--r.cnt], 1);
+        free (buf);
+        return false;
+      }
+
+  if (d->extent_cnt == INODE_EXTENTS)
+    {
+      /* Move the root down into a block of its own. */
+      block_sector_t sector;
+      struct extent_block *b = buf;
+
+      new_extent_block (&r, &sector, b);
+      b->cnt = d->extent_cnt;
+      memcpy (b->extents, d->extents, sizeof d->extents);
+      cache_write (sector, b);
+      d->extents[0].block = b->extents[0].block;
+      d->extents[0].start = sector;
+      d->extents[0].length = 0;
+      d->extent_cnt = 1;
+      d->depth++;
+    }
+  map_cache_clear (inode);
+  new.block = blk;
+  new.start = start;
+  new.length = cnt;
+  insert_extent (d->extents, &d->extent_cnt, INODE_EXTENTS, d->depth,
+                 new, &split, &r, buf);
+  ASSERT (split.start == 0);
+  cache_write (inode->sector, d);
+  free (buf);
+
+  /* Blocks not needed after all, because NEW merged with another
+     extent or a node had room. */
+  while (r.cnt > 0)
+    free_map_release (r.sectors[--r.cnt], 1);
+  return true;
+}
+
+/* Gives the sectors preallocated for INODE back to the free map.
+   Unused ones mean INODE isn't growing sequentially, so the
+   window shrinks back to its minimum. */
+static void
+prealloc_release (struct inode *inode)
+{
+  if (inode->pre_cnt > 0)
+    {
+      free_map_release (inode->pre_start, inode->pre_cnt);
+      inode->pre_cnt = 0;
+      inode->pre_window = PREALLOC_MIN;
+    }
+}
+
+/* Allocates up to *RUN consecutive sectors for INODE's file
+   blocks from BLK on, which must be unallocated, and returns the
+   first of them, with *RUN set to the number allocated.  Shorter
+   runs are tried if the disk has no free run that long.  Returns
+   0 if the disk is full.
+
+   HOLE is the number of unallocated blocks from BLK on.  If it
+   is more than *RUN, a regular file is likely being written
+   sequentially, so up to a window's worth of sectors past the run
+   is allocated along with it and kept for the blocks that follow,
+   letting later writes continue the run without going to the
+   free map.  The window doubles each time it is used up.  The
+   free map file is left out, because giving its sectors back
+   would write to it.
+
+   The sectors come from INODE's block group if it has room, so
+   a file's data and extent blocks stay near its inode. */
+static block_sector_t
+alloc_run (struct inode *inode, size_t blk, size_t *run, size_t hole)
+{
+  size_t cnt = *run, extra = 0;
+  block_sector_t start;
+
+  if (inode->pre_cnt > 0 && inode->pre_block == blk)
+    {
+      /* Continue into the preallocated sectors. */
+      if (cnt > inode->pre_cnt)
+        cnt = inode->pre_cnt;
+      start = inode->pre_start;
+      if (!add_extent (inode, blk, start, cnt))
+        return 0;
+      inode->pre_start += cnt;
+      inode->pre_block += cnt;
+      inode->pre_cnt -= cnt;
+      *run = cnt;
+      return start;
+    }
+
+  prealloc_release (inode);
+  if (hole > cnt && !inode->data.isdir && inode->sector != FREE_MAP_SECTOR)
+    extra = hole - cnt < inode->pre_window ? hole - cnt : inode->pre_window;
+  if (extra > 0 && free_map_allocate (inode->sector, cnt + extra, &start))
+    {
+      inode->pre_start = start + cnt;
+      inode->pre_block = blk + cnt;
+      inode->pre_cnt = extra;
+      if (inode->pre_window < PREALLOC_MAX)
+        inode->pre_window *= 2;
+    }
+  else
+    while (!free_map_allocate (inode->sector, cnt, &start))
+      if (cnt == 1)
+        return 0;
+      else
+        cnt /= 2;
+  if (!add_extent (inode, blk, start, cnt))
+    {
+      free_map_release (start, cnt);
+      prealloc_release (inode);
+      return 0;
+    }
+  *run = cnt;
+  return start;
+}
+
+/* Feeds a read of block BLK, held in SECTOR, to INODE's
+   read-ahead state.  A read of the block after the previous one
+   counts as sequential: the window doubles if read-ahead had
+   already brought the block in and halves if not, and the blocks
+   up to one window past BLK are queued for the cache-ahead
+   thread.  Any other read resets the window. */
+static void
+read_ahead (struct inode *inode, size_t blk, block_sector_t sector)
+{
+  size_t start, end, last;
+
+  lock_acquire (&inode->lock);
+  if (blk + 1 == inode->ra_next)
+    {
+      /* Same block again. */
+      lock_release (&inode->lock);
+      return;
+    }
+  if (blk != inode->ra_next)
+    {
+      inode->ra_window = RA_MIN;
+      inode->ra_end = blk + 1;
+      inode->ra_next = blk + 1;
+      lock_release (&inode->lock);
+      return;
+    }
+  if (cache_readahead_hit (sector))
+    inode->ra_window = inode->ra_window * 2 < RA_MAX
+                       ? inode->ra_window * 2 : RA_MAX;
+  else
+    inode->ra_window = inode->ra_window / 2 > RA_MIN
+                       ? inode->ra_window / 2 : RA_MIN;
+  inode->ra_next = blk + 1;
+
+  last = bytes_to_sectors (inode->data.length);
+  end = blk + 1 + inode->ra_window;
+  if (end > last)
+    end = last;
+  if (inode->ra_end < blk + 1)
+    inode->ra_end = blk + 1;
+  start = inode->ra_end;
+  if (inode->ra_end < end)
+    inode->ra_end = end;
+  lock_release (&inode->lock);
+
+  while (start < end)
+    {
+      size_t run;
+      block_sector_t ahead = lookup_run (inode, start, &run);
+
+      if (run > end - start)
+        run = end - start;
+      start += run;
+      if (ahead != 0)
+        for (; run > 0; run--)
+          cache_readahead (ahead++);
+    }
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -260,184 +943,193 @@ inode_remove (struct inode *inode)
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
-  off_t begin_offset=offset;
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  struct PosInfo pi;
-  uint32_t *arr=NULL;
-      arr=(uint32_t *)malloc(BLOCK_SECTOR_SIZE);
-  off_t cur_read;
-  while(size>0)
-  {
 
-    if(get_pos(&pi,offset)!=0)
-      goto end;
-    cur_read= 512-pi.off<size?512-pi.off:size;
-    if(pi.lev>=0)
+  rw_acquire_read (&inode->rw);
+  if (size > inode->data.length - offset)
+    size = inode->data.length - offset;
+  if (inode->data.flags & INODE_INLINE)
     {
-      uint32_t nsec=inode->data.blocks[pi.np[0]];
-      if(nsec!=0)
-      {
-        pi.sn[0]=nsec;
-        cache_read(nsec,(void *)arr);
-      }
-      else
-        goto end;
+      if (size > 0)
+        {
+          memcpy (buffer, inode->data.inline_data + offset, size);
+          bytes_read = size;
+        }
+      size = 0;
     }
-    if(pi.lev>=1)
+  while (size > 0)
     {
-      uint32_t nsec=arr[pi.np[1]];
-      if(nsec!=0)
-      {
-          pi.sn[1]=nsec;
-        cache_read(nsec,(void *)arr);
-      }
-      else
-        goto end;
-      
+      /* Look up a whole run of blocks at a time. */
+      size_t run;
+      block_sector_t nsec = lookup_run (inode, offset / BLOCK_SECTOR_SIZE,
+                                        &run);
+
+      for (; run > 0 && size > 0; run--)
+        {
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+          off_t cur_read = BLOCK_SECTOR_SIZE - sector_ofs < size
+                           ? BLOCK_SECTOR_SIZE - sector_ofs : size;
+
+          /* Unallocated parts of the file read as zeros. */
+          if (nsec == 0)
+            memset (buffer + bytes_read, 0, cur_read);
+          else
+            {
+              int h;
+              uint8_t *data;
+
+              read_ahead (inode, offset / BLOCK_SECTOR_SIZE, nsec);
+              /* Directory contents count as metadata in the cache
+                 statistics. */
+              data = cache_get (nsec, &h, inode->data.isdir ? CACHE_META : 0);
+              memcpy (buffer + bytes_read, data + sector_ofs, cur_read);
+              cache_put (h, false);
+              nsec++;
+            }
+          size -= cur_read;
+          offset += cur_read;
+          bytes_read += cur_read;
+        }
     }
-    if(pi.lev>=2)
+  rw_release (&inode->rw);
+  return bytes_read;
+}
+
+/* Moves the data of INODE, which is kept in the inode, out to
+   sectors of its own and maps them with an extent tree instead.
+   Returns false, leaving INODE as it was, if memory or disk
+   space runs out. */
+static off_t write_at (struct inode *, const void *, off_t, off_t);
+
+static bool
+inline_to_extents (struct inode *inode)
+{
+  struct inode_disk *d = &inode->data;
+  uint8_t *copy = malloc (INODE_INLINE_MAX);
+  bool ok;
+
+  if (copy == NULL)
+    return false;
+  memcpy (copy, d->inline_data, INODE_INLINE_MAX);
+  memset (d->extents, 0, sizeof d->extents);
+  d->flags &= ~INODE_INLINE;
+  d->depth = 0;
+  d->extent_cnt = 0;
+  map_cache_clear (inode);
+  ok = write_at (inode, copy, d->length, 0) == d->length;
+  if (!ok)
     {
-      uint32_t nsec=arr[pi.np[2]];
-      if(nsec!=0)
-      {
-        pi.sn[2]=nsec;
-        cache_read(nsec,(void *)arr);
-      }
-      else goto end;
+      /* INODE_INLINE_MAX bytes take at most one sector. */
+      ASSERT (d->depth == 0 && d->extent_cnt <= 1);
+      if (d->extent_cnt > 0)
+        free_map_release (d->extents[0].start, d->extents[0].length);
+      prealloc_release (inode);
+      map_cache_clear (inode);
+      d->flags |= INODE_INLINE;
+      d->depth = 0;
+      d->extent_cnt = 0;
+      memcpy (d->inline_data, copy, INODE_INLINE_MAX);
     }
-    if(pi.lev>=3)
-    {
-      uint32_t nsec=arr[pi.np[3]];
-      if(nsec!=0)
-      {
-        pi.sn[3]=nsec;
-        cache_read(nsec,(void*)arr);
-      }
-      else
-        goto end;
-    }
-    ASSERT(pi.lev<4);
-    memcpy(buffer+bytes_read,(void *)arr+pi.off,cur_read);
-    size-=cur_read;
-    offset+=cur_read;
-    bytes_read+=cur_read;
-    continue;
-    end:
-      memset(buffer+bytes_read,0,cur_read);
-      bytes_read+=cur_read;
-      size-=cur_read;
-      offset+=cur_read;
-  }
-  free(arr);
-  off_t ShouldRead=inode->data.length-begin_offset;
-  if(ShouldRead<0)
-    ShouldRead=0;
-  if(ShouldRead<bytes_read)
-    bytes_read=ShouldRead;
-  return bytes_read;
+  cache_write (inode->sector, d);
+  free (copy);
+  return ok;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the write would go past
+   the largest file size.  Writing past end of file extends the
+   inode. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset)
+{
+  off_t bytes_written = 0;
+
+  rw_acquire_write (&inode->rw);
+  if (!inode->deny_write_cnt)
+    bytes_written = write_at (inode, buffer, size, offset);
+  rw_release (&inode->rw);
+  return bytes_written;
+}
+
+/* Does the work of inode_write_at(), with INODE's rw held for
+   writing. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+          off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
-
-  if (inode->deny_write_cnt)
-    return 0;
-  struct PosInfo pi;
-  uint32_t *arr=NULL;
-  //while(arr==NULL)
- arr=(uint32_t *)malloc(BLOCK_SECTOR_SIZE);
-  uint32_t cur_write;
-  while(size>0)
-  {
-    get_pos(&pi,offset);
-    cur_write=512-pi.off<size?512-pi.off:size;
-    if(pi.lev>=0)
-    {
-      uint32_t nsec=inode->data.blocks[pi.np[0]];
-      if(nsec==0)
-      {
-          if (!free_map_allocate (1, &nsec))
-        goto end;
-      inode->data.blocks[pi.np[0]]=nsec;
-      memset(arr,0,512);
-      }
-      else
-        cache_read(nsec,arr);
-      pi.sn[0]=nsec;
-    }
-    if(pi.lev>=1)
+
+  if (inode->data.flags & INODE_INLINE)
     {
-      uint32_t nsec=arr[pi.np[1]];
-      if(nsec==0)
-      {
-        if(!free_map_allocate(1,&nsec))
-          goto end;
-        arr[pi.np[1]]=nsec;
-        cache_write(pi.sn[0],arr);
-        memset(arr,0,512);
-      }
-      else
-        cache_read(nsec,arr);
-      pi.sn[1]=nsec;
+      /* Data that still fits stays in the inode. */
+      if (offset + size <= INODE_INLINE_MAX)
+        {
+          if (size <= 0)
+            return 0;
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (offset + size > inode->data.length)
+            inode->data.length = offset + size;
+          cache_write (inode->sector, &inode->data);
+          return size;
+        }
+      if (!inline_to_extents (inode))
+        return 0;
     }
-    if(pi.lev>=2)
+  while (size > 0)
     {
-      uint32_t nsec=arr[pi.np[2]];
-      if(nsec==0)
-      {
-        if(!free_map_allocate(1,&nsec))
-          goto end;
-        arr[pi.np[2]]=nsec;
-        cache_write(pi.sn[1],arr);
-        memset(arr,0,512);
-      }
-      else
-        cache_read(nsec,arr);
-      pi.sn[2]=nsec;
+      size_t blk = offset / BLOCK_SECTOR_SIZE;
+      size_t want = DIV_ROUND_UP (offset % BLOCK_SECTOR_SIZE + size,
+                                  BLOCK_SECTOR_SIZE);
+      size_t run, hole;
+      block_sector_t nsec = lookup_run (inode, blk, &run);
+      bool fresh = nsec == 0;
+
+      /* Fill a hole with as few runs of sectors as the disk
+         allows. */
+      hole = run;
+      if (run > want)
+        run = want;
+      if (fresh)
+        {
+          nsec = alloc_run (inode, blk, &run, hole);
+          if (nsec == 0)
+            break;
+        }
+      for (; run > 0; run--, nsec++)
+        {
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+          off_t cur_write = BLOCK_SECTOR_SIZE - sector_ofs < size
+                            ? BLOCK_SECTOR_SIZE - sector_ofs : size;
+
+          if (cur_write == BLOCK_SECTOR_SIZE)
+            cache_write (nsec, buffer + bytes_written);
+          else
+            {
+              int h;
+              uint8_t *data;
+
+              /* A new sector's old contents must not show through. */
+              if (fresh)
+                cache_zero (nsec);
+              data = cache_get (nsec, &h, CACHE_WRITE
+                                | (inode->data.isdir ? CACHE_META : 0));
+              memcpy (data + sector_ofs, buffer + bytes_written, cur_write);
+              cache_put (h, true);
+            }
+          bytes_written += cur_write;
+          offset += cur_write;
+          size -= cur_write;
+        }
     }
-    if(pi.lev>=3)
-    {
-      uint32_t nsec=arr[pi.np[3]];
-      if(nsec==0)
-      {
-        if(!free_map_allocate(1,&nsec))
-          goto end;
-        arr[pi.np[3]]=nsec;
-        cache_write(pi.sn[2],arr);
-        memset(arr,0,512);
-      }
-      else
-        cache_read(nsec,arr);
-      pi.sn[3]=nsec;
-    }
-    if(pi.lev>=4)
-      goto end;
-    memcpy((void *)arr+pi.off,buffer+bytes_written,cur_write);
-    cache_write(pi.sn[pi.lev],arr);
-    bytes_written+=cur_write;
-    offset+=cur_write;
-    size-=cur_write;
-  }
- end:
-  if(offset > inode->data.length)
+  if (offset > inode->data.length)
   {
-    inode->data.length=offset;
-  cache_write(inode->sector,&inode->data);
-  } 
-  //lock_release(&inode->xlock);
-//  lock_release(&inode->slock);
-  free(arr);
+    inode->data.length = offset;
+    cache_write (inode->sector, &inode->data);
+  }
   return bytes_written;
 }
 
@@ -446,8 +1138,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rw_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rw_release (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -456,9 +1150,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rw_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_release (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -469,66 +1165,21 @@ inode_length (const struct inode *inode)
 }
 
 
-int get_pos(struct PosInfo *pi,off_t off)
+/* Returns the sector of the inode holding directory INODE's hash
+   index, or 0 if it has none. */
+block_sector_t
+inode_get_index (const struct inode *inode)
 {
-  if(off<0||off>=indirect3) return 1;
-  if(off>=indirect2)
-  {
-    off-=indirect2;
-    pi->lev=3;
-    
-    pi->sn[0]=0;
-    pi->np[0]=14;
-
-    pi->sn[1]=0;
-    pi->np[1]=off/(128*128*512);
-    off-=pi->np[1]*(128*128*512);
-
-    pi->sn[2]=0;
-    pi->np[2]=off/(128*512);
-    off-=pi->np[2]*(128*512);
-
-    pi->sn[3]=0;
-    pi->np[3]=off/512;
-    pi->off=off%512;
-  }
-  else if(off>=indirect1)
-  {
-    off-=indirect1;
-    pi->lev=2;
-
-    pi->sn[0]=0;
-    pi->np[0]=13;
-
-    pi->sn[1]=0;
-    pi->np[1]=off/(512*128);
-
-    off-=pi->np[1]*(512*128);
-
-    pi->sn[2]=0;
-    pi->np[2]=off/512;
-
-    pi->off=off%512;
-  }
-  else if(off>=direct)
-  {
-    off-=direct;
-    pi->lev=1;
-
-    pi->sn[0]=0;
-    pi->np[0]=12;
-
-    pi->sn[1]=0;
-    pi->np[1]=off/512;
+  return inode->data.dir_index;
+}
 
-    pi->off=off%512;
-  }
-  else
-  {
-    pi->lev=0;
-    pi->sn[0]=0;
-    pi->np[0]=off/512;  
-    pi->off=off%512;
-  }
-  return 0;
-}
\ No newline at end of file
+/* Makes the inode in SECTOR directory INODE's hash index.  It is
+   freed along with INODE. */
+void
+inode_set_index (struct inode *inode, block_sector_t sector)
+{
+  rw_acquire_write (&inode->rw);
+  inode->data.dir_index = sector;
+  cache_write (inode->sector, &inode->data);
+  rw_release (&inode->rw);
+}
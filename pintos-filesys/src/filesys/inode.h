@@ -4,49 +4,106 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
+#include <hash.h>
 #include <list.h>
-
-#define BLOCK_NUM 15
+#include "threads/synch.h"
 
 struct bitmap;
 
+/* A run of LENGTH sectors of file data: file blocks BLOCK
+   through BLOCK + LENGTH - 1 are stored in sectors START through
+   START + LENGTH - 1.  In an index node of the extent tree, START
+   is instead the child node mapping the file blocks from BLOCK
+   up to the next entry's BLOCK, and LENGTH is unused. */
+struct extent
+  {
+    uint32_t block;                     /* First file block. */
+    block_sector_t start;               /* First sector, or child node. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Extent tree entries held in the inode itself. */
+#define INODE_EXTENTS 40
 
+/* Bytes of data a file may have and still be kept in its inode,
+   in place of the extent tree. */
+#define INODE_INLINE_MAX 484
+
+/* inode_disk flags. */
+#define INODE_INLINE 1                  /* Data is in inline_data[]. */
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[109];               /* Not used. */
-    unsigned isdir;
-    uint32_t blocks[BLOCK_NUM];   //三级索引区
+    unsigned isdir;                     /* 1 for a directory, else 0. */
+    uint32_t depth;                     /* Extent block levels below. */
+    uint32_t extent_cnt;                /* Entries used in extents[]. */
+    uint32_t flags;                     /* INODE_* flags. */
+    block_sector_t dir_index;           /* Directory's hash index, or 0. */
+    union
+      {
+        struct extent extents[INODE_EXTENTS]; /* Root of the extent tree. */
+        uint8_t inline_data[INODE_INLINE_MAX]; /* Data of a small file. */
+      };
   };
 
-/* In-memory inode. */
+/* Runs remembered by an open inode's block-map lookup cache. */
+#define MAP_CACHE_SIZE 4
+
+/* In-memory inode.
+
+   RW guards the inode's data and the preallocated sectors: reads
+   hold it shared, writes and removal exclusively.  Readers also
+   update the read-ahead state and the block-map lookup cache, so
+   those are guarded by LOCK instead.  DIR_LOCK is for directory.c,
+   which holds it shared while it looks up a directory's entries
+   and exclusively while it changes them. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
+    struct list_elem reclaim_elem;      /* Element in reclaim_list. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rw;                   /* Guards data and pre_*. */
+    struct lock lock;                   /* Guards ra_* and map*. */
+    struct rwlock dir_lock;             /* Guards directory entries. */
+    size_t ra_next;                     /* Block a sequential read reads next. */
+    size_t ra_end;                      /* First block not yet read ahead. */
+    size_t ra_window;                   /* Read-ahead window, in blocks. */
+    struct extent map[MAP_CACHE_SIZE];  /* Runs found lately, START 0
+                                           for holes, LENGTH 0 if unused. */
+    int map_next;                       /* Entry of map[] to replace next. */
+    block_sector_t map_leaf;            /* Leaf extent block found last. */
+    uint32_t map_leaf_lo;               /* First file block it maps. */
+    uint32_t map_leaf_hi;               /* File block past those it maps. */
+    block_sector_t pre_start;           /* Preallocated sectors... */
+    size_t pre_cnt;                     /* ...how many are left... */
+    size_t pre_block;                   /* ...and the file block they'd hold. */
+    size_t pre_window;                  /* Sectors to preallocate next. */
     struct inode_disk data;             /* Inode content. */
   };
 
 void inode_init (void);
+bool inode_reclaim (void);
 bool inode_create (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_release_preallocs (void);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+block_sector_t inode_get_index (const struct inode *);
+void inode_set_index (struct inode *, block_sector_t);
 
 bool inode_create_extend (block_sector_t sector, off_t length,uint32_t isdir);
 
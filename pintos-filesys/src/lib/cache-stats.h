@@ -0,0 +1,30 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache statistics, as returned by the cache_stats system
+   call and printed at shutdown. */
+
+/* Number of buckets in the miss latency histogram.  Bucket I
+   counts misses that took less than 2**(I + CACHE_LATENCY_SHIFT)
+   CPU cycles, and more than bucket I - 1's bound; the last bucket
+   counts every slower miss too. */
+#define CACHE_LATENCY_BUCKETS 16
+#define CACHE_LATENCY_SHIFT 12
+
+struct cache_stats
+  {
+    unsigned long long hits;            /* Reads of data found cached. */
+    unsigned long long misses;          /* Reads of data from disk. */
+    unsigned long long meta_hits;       /* Reads of metadata found cached. */
+    unsigned long long meta_misses;     /* Reads of metadata from disk. */
+    unsigned long long evictions;       /* Sectors dropped from the cache. */
+    unsigned long long write_backs;     /* Dirty sectors written back. */
+    unsigned long long write_requests;  /* Device requests doing so. */
+    unsigned long long lock_waits;      /* Times a cache lock was busy. */
+    unsigned long long slot_waits;      /* Times a cached sector was busy. */
+    unsigned sectors;                   /* Current capacity in sectors. */
+    unsigned max_sectors;               /* Largest possible capacity. */
+    unsigned long long miss_latency[CACHE_LATENCY_BUCKETS];
+  };
+
+#endif /* lib/cache-stats.h */
@@ -27,9 +27,33 @@ typedef unsigned long elem_type;
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
+    size_t next;        /* Where bitmap_scan_and_flip_next() starts. */
     elem_type *bits;    /* Elements that represent bits. */
+
+    /* Summary, set up by bitmap_summarize(), or null pointers.
+
+       NONFULL has a bit per element of BITS, set if the element
+       has a bit set to false, and NONFULL2 has a bit per element
+       of NONFULL, set if it is not zero, so elements of BITS with
+       nothing free are skipped a whole element of summary at a
+       time.
+
+       The elements of BITS covered by one element of NONFULL form
+       a group of GROUP_BITS bits, and MAX_RUN[G] is at least the
+       length of the longest run of false bits in group G, counting
+       only its part inside the group.  Setting bits to false
+       raises it to GROUP_BITS; a bitmap_scan_and_flip() or
+       bitmap_scan_and_flip_next() that passes over the whole
+       group sets it to the exact length.  bitmap_scan() only
+       reads it, since it may not change B. */
+    elem_type *nonfull;
+    elem_type *nonfull2;
+    uint16_t *max_run;
   };
 
+/* Bits in a group of the summary. */
+#define GROUP_BITS (ELEM_BITS * ELEM_BITS)
+
 /* Returns the index of the element that contains the bit
    numbered BIT_IDX. */
 static inline size_t
@@ -68,6 +92,108 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns the number of elements in the summary's NONFULL for a
+   bitmap of BIT_CNT bits, which is also its number of groups. */
+static inline size_t
+group_cnt (size_t bit_cnt)
+{
+  return elem_cnt (elem_cnt (bit_cnt));
+}
+
+/* Returns the index of the first element of B's bits at or after
+   IDX that has a bit set to false, according to B's summary, or
+   the number of elements if there is none. */
+static size_t
+next_nonfull (const struct bitmap *b, size_t idx)
+{
+  size_t elems = elem_cnt (b->bit_cnt);
+  size_t group = idx / ELEM_BITS;
+  elem_type elem;
+
+  if (idx >= elems)
+    return elems;
+  elem = b->nonfull[group] & ~(bit_mask (idx) - 1);
+  if (elem == 0)
+    {
+      /* Find the next group with any such element in NONFULL2. */
+      size_t idx2 = elem_idx (++group);
+
+      if (group >= group_cnt (b->bit_cnt))
+        return elems;
+      elem = b->nonfull2[idx2] & ~(bit_mask (group) - 1);
+      while (elem == 0)
+        {
+          if (++idx2 >= elem_cnt (group_cnt (b->bit_cnt)))
+            return elems;
+          elem = b->nonfull2[idx2];
+        }
+      group = idx2 * ELEM_BITS + __builtin_ctzl (elem);
+      elem = b->nonfull[group];
+    }
+  return group * ELEM_BITS + __builtin_ctzl (elem);
+}
+
+/* Brings B's summary up to date after element IDX of its bits
+   changed.  FREED says whether any bits may have been set to
+   false. */
+static void
+update_summary (struct bitmap *b, size_t idx, bool freed)
+{
+  size_t group = idx / ELEM_BITS;
+  elem_type used = (idx == elem_cnt (b->bit_cnt) - 1
+                    ? last_mask (b) : (elem_type) -1);
+
+  if (b->nonfull == NULL)
+    return;
+  if ((b->bits[idx] & used) != used)
+    {
+      b->nonfull[group] |= bit_mask (idx);
+      b->nonfull2[elem_idx (group)] |= bit_mask (group);
+      if (freed)
+        b->max_run[group] = GROUP_BITS;
+    }
+  else
+    {
+      b->nonfull[group] &= ~bit_mask (idx);
+      if (b->nonfull[group] == 0)
+        b->nonfull2[elem_idx (group)] &= ~bit_mask (group);
+    }
+}
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's size if there is none.  Elements
+   without such a bit are skipped whole, through the summary if B
+   has one and VALUE is false, and the bit is found in the element
+   that has one with a bit scan (BSF). */
+static size_t
+find_bit (const struct bitmap *b, size_t start, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx = elem_idx (start);
+  elem_type elem;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+  elem = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  if (elem == 0 && !value && b->nonfull != NULL)
+    {
+      idx = next_nonfull (b, idx + 1);
+      if (idx >= elem_cnt (b->bit_cnt))
+        return b->bit_cnt;
+      elem = ~b->bits[idx];
+    }
+  while (elem == 0)
+    {
+      if (++idx >= elem_cnt (b->bit_cnt))
+        return b->bit_cnt;
+      elem = b->bits[idx] ^ flip;
+    }
+
+  /* The unused bits of the last element may match too. */
+  start = idx * ELEM_BITS + __builtin_ctzl (elem);
+  return start < b->bit_cnt ? start : b->bit_cnt;
+}
 
 /* Creation and destruction. */
 
@@ -82,6 +208,9 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->next = 0;
+      b->nonfull = b->nonfull2 = NULL;
+      b->max_run = NULL;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -104,6 +233,9 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
+  b->next = 0;
+  b->nonfull = b->nonfull2 = NULL;
+  b->max_run = NULL;
   b->bits = (elem_type *) (b + 1);
   bitmap_set_all (b, false);
   return b;
@@ -117,6 +249,46 @@ bitmap_buf_size (size_t bit_cnt)
   return sizeof (struct bitmap) + byte_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes of storage that bitmap_summarize()
+   needs for a bitmap with BIT_CNT bits. */
+size_t
+bitmap_summary_size (size_t bit_cnt)
+{
+  size_t groups = group_cnt (bit_cnt);
+
+  return (sizeof (elem_type) * (groups + elem_cnt (groups))
+          + sizeof (uint16_t) * groups);
+}
+
+/* Adds a summary to B, kept in the SIZE bytes at BLOCK, which
+   must be at least bitmap_summary_size() of B's size and stay
+   allocated as long as B.  The summary lets bitmap_scan() and
+   friends skip over parts of B that have no group of false bits
+   of the size wanted, which makes finding free bits in a large
+   bitmap that is mostly used much faster.  Bits are still set
+   atomically, but updating the summary with them is not, so
+   once B has a summary its users must serialize all access to
+   it, including scans, which refine the summary as they go. */
+void
+bitmap_summarize (struct bitmap *b, void *block, size_t size UNUSED)
+{
+  size_t groups = group_cnt (b->bit_cnt);
+  size_t i;
+
+  ASSERT (b != NULL);
+  ASSERT (size >= bitmap_summary_size (b->bit_cnt));
+
+  b->nonfull = block;
+  b->nonfull2 = b->nonfull + groups;
+  b->max_run = (uint16_t *) (b->nonfull2 + elem_cnt (groups));
+  for (i = 0; i < groups; i++)
+    b->nonfull[i] = 0;
+  for (i = 0; i < elem_cnt (groups); i++)
+    b->nonfull2[i] = 0;
+  for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+    update_summary (b, i, true);
+}
+
 /* Destroys bitmap B, freeing its storage.
    Not for use on bitmaps created by bitmap_create_in_buf(). */
 void
@@ -163,6 +335,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx, false);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -176,6 +349,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  update_summary (b, idx, true);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -191,6 +365,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx, true);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +388,31 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE, an element
+   at a time, each atomically like bitmap_set(). */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (cnt > 0)
+    {
+      size_t ofs = start % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < cnt ? ELEM_BITS - ofs : cnt;
+      size_t idx = elem_idx (start);
+      elem_type mask = (n < ELEM_BITS
+                        ? ((elem_type) 1 << n) - 1 : (elem_type) -1) << ofs;
+
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+      update_summary (b, idx, !value);
+      start += n;
+      cnt -= n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -250,16 +438,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return cnt > 0 && find_bit (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -288,6 +471,139 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Returns the starting index of the first group of CNT
+   consecutive bits in B that are all set to VALUE and start
+   between START and LAST, inclusive, or BITMAP_ERROR if there is
+   none.  Each step jumps to the next bit set to VALUE and then
+   past the group starting there, so it takes time proportional
+   to the number of elements and groups passed over, not bits.
+   HINT is B if the scan may refine B's summary, otherwise a null
+   pointer. */
+static size_t scan_free (const struct bitmap *, struct bitmap *hint,
+                         size_t start, size_t last, size_t cnt);
+
+static size_t
+scan_between (const struct bitmap *b, struct bitmap *hint,
+              size_t start, size_t last, size_t cnt, bool value)
+{
+  if (!value && b->nonfull != NULL)
+    return scan_free (b, hint, start, last, cnt);
+  while (start <= last)
+    {
+      size_t end;
+
+      start = find_bit (b, start, value);
+      if (start > last)
+        break;
+      end = find_bit (b, start, !value);
+      if (end - start >= cnt)
+        return start;
+      start = end;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Returns the index of the first bit of the run of false bits
+   that ends group GROUP of B, or the end of the group if its last
+   bit is true. */
+static size_t
+trailing_free (const struct bitmap *b, size_t group)
+{
+  size_t first = group * ELEM_BITS;
+  size_t idx = elem_idx (group * GROUP_BITS + GROUP_BITS - 1);
+  size_t end = group * GROUP_BITS + GROUP_BITS;
+
+  if (end > b->bit_cnt)
+    {
+      end = b->bit_cnt;
+      idx = elem_idx (end - 1);
+    }
+  for (;;)
+    {
+      elem_type elem = b->bits[idx];
+      size_t pos;
+
+      if (idx == elem_idx (end - 1) && end % ELEM_BITS != 0)
+        elem &= bit_mask (end) - 1;
+      if (elem != 0)
+        {
+          pos = idx * ELEM_BITS + (ELEM_BITS - 1 - __builtin_clzl (elem));
+          return pos + 1;
+        }
+      if (idx == first)
+        return group * GROUP_BITS;
+      idx--;
+    }
+}
+
+/* scan_between() for false bits in a bitmap with a summary.  A
+   group whose MAX_RUN is less than CNT can only hold the start
+   of a long enough run in the free bits that end it, so the scan
+   jumps straight to those. */
+static size_t
+scan_free (const struct bitmap *b, struct bitmap *hint,
+           size_t start, size_t last, size_t cnt)
+{
+  while (start <= last)
+    {
+      size_t group = start / GROUP_BITS;
+      size_t group_end = group * GROUP_BITS + GROUP_BITS;
+      bool whole = start == group * GROUP_BITS;
+      size_t longest = 0;
+
+      if (b->max_run[group] < cnt)
+        {
+          size_t end, tail = trailing_free (b, group);
+
+          if (start < tail)
+            start = tail;
+          if (start > last || start >= b->bit_cnt)
+            break;
+          if (start < group_end)
+            {
+              end = find_bit (b, start, true);
+              if (end - start >= cnt)
+                return start;
+              start = end;
+            }
+          continue;
+        }
+
+      while (start < group_end && start <= last)
+        {
+          size_t end;
+
+          start = find_bit (b, start, false);
+          if (start >= group_end || start > last)
+            break;
+          end = find_bit (b, start, true);
+          if (end - start >= cnt)
+            return start;
+          if ((end < group_end ? end : group_end) - start > longest)
+            longest = (end < group_end ? end : group_end) - start;
+          start = end;
+        }
+      if (hint != NULL && whole && start >= group_end)
+        hint->max_run[group] = longest;
+    }
+  return BITMAP_ERROR;
+}
+
+/* bitmap_scan(), refining HINT's summary as scan_between() does. */
+static size_t
+scan (const struct bitmap *b, struct bitmap *hint, size_t start, size_t cnt,
+      bool value)
+{
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+  if (cnt <= b->bit_cnt) 
+    return scan_between (b, hint, start, b->bit_cnt - cnt, cnt, value);
+  return BITMAP_ERROR;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -295,18 +611,7 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  ASSERT (b != NULL);
-  ASSERT (start <= b->bit_cnt);
-
-  if (cnt <= b->bit_cnt) 
-    {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
-    }
-  return BITMAP_ERROR;
+  return scan (b, NULL, start, cnt, value);
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -319,11 +624,62 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t idx = bitmap_scan (b, start, cnt, value);
+  size_t idx = scan (b, b, start, cnt, value);
   if (idx != BITMAP_ERROR) 
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but only takes a group that
+   starts before END, so that a search confined to part of B
+   doesn't scan the rest of it. */
+size_t
+bitmap_scan_and_flip_before (struct bitmap *b, size_t start, size_t end,
+                             size_t cnt, bool value)
+{
+  size_t idx, last;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= end && end <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+  if (cnt > b->bit_cnt || start >= end)
+    return BITMAP_ERROR;
+  last = end - 1 < b->bit_cnt - cnt ? end - 1 : b->bit_cnt - cnt;
+  idx = scan_between (b, b, start, last, cnt, value);
+  if (idx != BITMAP_ERROR)
+    bitmap_set_multiple (b, idx, cnt, !value);
+  return idx;
+}
+
+/* Like bitmap_scan_and_flip(), but instead of a fixed starting
+   point, starts where the group found by the previous call
+   ended, and wraps around to the start of B if it finds nothing
+   by the end.  A caller that keeps taking groups from B this way
+   (next fit) skips the part that it has just filled instead of
+   scanning it again each time. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value)
+{
+  size_t idx;
+
+  ASSERT (b != NULL);
+
+  if (cnt == 0 || cnt > b->bit_cnt)
+    return cnt == 0 ? 0 : BITMAP_ERROR;
+  if (b->next > b->bit_cnt - cnt)
+    b->next = 0;
+  idx = scan_between (b, b, b->next, b->bit_cnt - cnt, cnt, value);
+  if (idx == BITMAP_ERROR && b->next > 0)
+    idx = scan_between (b, b, 0, b->next - 1, cnt, value);
+  if (idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->next = idx + cnt;
+    }
+  return idx;
+}
 
 /* File input and output. */
 
@@ -346,6 +702,12 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      if (b->nonfull != NULL)
+        {
+          size_t i;
+          for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+            update_summary (b, i, true);
+        }
     }
   return success;
 }
@@ -358,6 +720,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes bytes OFS through OFS + SIZE - 1 of what bitmap_write()
+   would write for B, stopping early at its end, to the same
+   place in FILE.  Return true if successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return (file_write_at (file, (const char *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -11,6 +11,8 @@
 struct bitmap *bitmap_create (size_t bit_cnt);
 struct bitmap *bitmap_create_in_buf (size_t bit_cnt, void *, size_t byte_cnt);
 size_t bitmap_buf_size (size_t bit_cnt);
+size_t bitmap_summary_size (size_t bit_cnt);
+void bitmap_summarize (struct bitmap *, void *, size_t byte_cnt);
 void bitmap_destroy (struct bitmap *);
 
 /* Bitmap size. */
@@ -36,6 +38,9 @@ bool bitmap_all (const struct bitmap *, size_t start, size_t cnt);
 #define BITMAP_ERROR SIZE_MAX
 size_t bitmap_scan (const struct bitmap *, size_t start, size_t cnt, bool);
 size_t bitmap_scan_and_flip (struct bitmap *, size_t start, size_t cnt, bool);
+size_t bitmap_scan_and_flip_next (struct bitmap *, size_t cnt, bool);
+size_t bitmap_scan_and_flip_before (struct bitmap *, size_t start, size_t end,
+                                    size_t cnt, bool);
 
 /* File input and output. */
 #ifdef FILESYS
@@ -43,6 +48,8 @@ struct file;
 size_t bitmap_file_size (const struct bitmap *);
 bool bitmap_read (struct bitmap *, struct file *);
 bool bitmap_write (const struct bitmap *, struct file *);
+bool bitmap_write_part (const struct bitmap *, struct file *,
+                        size_t ofs, size_t size);
 #endif
 
 /* Debugging. */
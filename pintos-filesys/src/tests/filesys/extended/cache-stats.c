@@ -0,0 +1,42 @@
+/* Checks that the cache_stats system call fills in the buffer
+   cache's statistics, and that rereading a file shows up as
+   cache hits.  Then passes a buffer that runs past the top of
+   user memory, which must terminate the process with -1 exit
+   code. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4096];
+
+void
+test_main (void) 
+{
+  struct cache_stats before, after;
+  int fd;
+
+  CHECK (create ("data", sizeof buf), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  memset (buf, 'x', sizeof buf);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"data\"");
+
+  memset (&before, 0, sizeof before);
+  CHECK (cache_stats (&before), "cache_stats");
+  if (before.sectors == 0 || before.sectors > before.max_sectors)
+    fail ("cache_stats reported %u of at most %u sectors",
+          before.sectors, before.max_sectors);
+
+  seek (fd, 0);
+  CHECK (read (fd, buf, sizeof buf) == sizeof buf, "read \"data\"");
+  CHECK (cache_stats (&after), "cache_stats again");
+  if (after.hits <= before.hits)
+    fail ("rereading \"data\" gave no cache hits");
+  msg ("rereading \"data\" hit the cache");
+
+  msg ("cache_stats past the top of user memory");
+  cache_stats ((struct cache_stats *) ((char *) 0xc0000000
+                                       - sizeof before / 2));
+  fail ("should have exited with -1");
+}
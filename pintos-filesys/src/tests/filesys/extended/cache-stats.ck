@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(cache-stats) begin
+(cache-stats) create "data"
+(cache-stats) open "data"
+(cache-stats) write "data"
+(cache-stats) cache_stats
+(cache-stats) read "data"
+(cache-stats) cache_stats again
+(cache-stats) rereading "data" hit the cache
+(cache-stats) cache_stats past the top of user memory
+cache-stats: exit(-1)
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($d) = {};
+$d->{"f$_"} = [''] foreach grep ($_ % 3 != 0, 0...299);
+$d->{"g$_"} = [''] foreach grep ($_ % 6 == 0, 0...299);
+check_archive ({"d" => $d});
+pass;
@@ -0,0 +1,85 @@
+/* Creates a few hundred files in one directory, enough for it to
+   get a hash index, then removes some of them and adds others,
+   checking that open() and readdir() see exactly the files that
+   should be there. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 300
+
+/* Whether file I goes by "fI" (with F) or "gI" (without) now. */
+static bool
+exists (int i, bool f) 
+{
+  return f ? i % 3 != 0 : i % 6 == 0;
+}
+
+void
+test_main (void) 
+{
+  static bool seen[2][FILE_CNT];
+  char name[READDIR_MAX_LEN + 1];
+  char path[32];
+  int i, cnt, fd;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (path, sizeof path, "d/f%d", i);
+      if (!create (path, 0))
+        fail ("create \"%s\" failed", path);
+    }
+  msg ("remove every third file");
+  for (i = 0; i < FILE_CNT; i += 3) 
+    {
+      snprintf (path, sizeof path, "d/f%d", i);
+      if (!remove (path))
+        fail ("remove \"%s\" failed", path);
+      if (remove (path))
+        fail ("removed \"%s\" twice", path);
+    }
+  msg ("create files under new names");
+  for (i = 0; i < FILE_CNT; i += 6) 
+    {
+      snprintf (path, sizeof path, "d/g%d", i);
+      if (!create (path, 0))
+        fail ("create \"%s\" failed", path);
+      if (create (path, 0))
+        fail ("created \"%s\" twice", path);
+    }
+
+  msg ("open each name");
+  for (i = 0; i < FILE_CNT * 2; i++) 
+    {
+      bool f = i < FILE_CNT;
+      snprintf (path, sizeof path, "d/%c%d", f ? 'f' : 'g', i % FILE_CNT);
+      fd = open (path);
+      if ((fd > 1) != exists (i % FILE_CNT, f))
+        fail ("open \"%s\" returned %d", path, fd);
+      if (fd > 1)
+        close (fd);
+    }
+
+  msg ("readdir \"d\"");
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  cnt = 0;
+  while (readdir (fd, name)) 
+    {
+      bool f = name[0] == 'f';
+      i = atoi (name + 1);
+      if ((name[0] != 'f' && name[0] != 'g') || i < 0 || i >= FILE_CNT
+          || !exists (i, f) || seen[f][i])
+        fail ("readdir returned unexpected \"%s\"", name);
+      seen[f][i] = true;
+      cnt++;
+    }
+  if (cnt != FILE_CNT - FILE_CNT / 3 + FILE_CNT / 6)
+    fail ("readdir returned %d names", cnt);
+  close (fd);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-index) begin
+(dir-index) mkdir "d"
+(dir-index) create 300 files
+(dir-index) remove every third file
+(dir-index) create files under new names
+(dir-index) open each name
+(dir-index) readdir "d"
+(dir-index) open "d"
+(dir-index) end
+EOF
+pass;
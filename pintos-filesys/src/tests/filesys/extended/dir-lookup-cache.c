@@ -0,0 +1,37 @@
+/* Checks that lookups of names that didn't exist, and of names
+   that did, give way to later creates and removes, including in a
+   directory made after another was removed, which may reuse its
+   sector. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (open ("x") == -1, "open \"x\" (must fail)");
+  CHECK (open ("x") == -1, "open \"x\" again (must fail)");
+  CHECK (create ("x", 10), "create \"x\"");
+  CHECK ((fd = open ("x")) > 1, "open \"x\"");
+  close (fd);
+  CHECK (remove ("x"), "remove \"x\"");
+  CHECK (open ("x") == -1, "open \"x\" after remove (must fail)");
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/x", 20), "create \"a/x\"");
+  CHECK ((fd = open ("a/x")) > 1, "open \"a/x\"");
+  close (fd);
+  CHECK (open ("a/y") == -1, "open \"a/y\" (must fail)");
+  CHECK (remove ("a/x"), "remove \"a/x\"");
+  CHECK (remove ("a"), "remove \"a\"");
+  CHECK (open ("a/x") == -1, "open \"a/x\" after remove (must fail)");
+
+  CHECK (mkdir ("b"), "mkdir \"b\"");
+  CHECK (open ("b/x") == -1, "open \"b/x\" (must fail)");
+  CHECK (create ("b/y", 30), "create \"b/y\"");
+  CHECK ((fd = open ("b/y")) > 1, "open \"b/y\"");
+  close (fd);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-lookup-cache) begin
+(dir-lookup-cache) open "x" (must fail)
+(dir-lookup-cache) open "x" again (must fail)
+(dir-lookup-cache) create "x"
+(dir-lookup-cache) open "x"
+(dir-lookup-cache) remove "x"
+(dir-lookup-cache) open "x" after remove (must fail)
+(dir-lookup-cache) mkdir "a"
+(dir-lookup-cache) create "a/x"
+(dir-lookup-cache) open "a/x"
+(dir-lookup-cache) open "a/y" (must fail)
+(dir-lookup-cache) remove "a/x"
+(dir-lookup-cache) remove "a"
+(dir-lookup-cache) open "a/x" after remove (must fail)
+(dir-lookup-cache) mkdir "b"
+(dir-lookup-cache) open "b/x" (must fail)
+(dir-lookup-cache) create "b/y"
+(dir-lookup-cache) open "b/y"
+(dir-lookup-cache) end
+EOF
+pass;
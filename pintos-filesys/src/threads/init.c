@@ -37,6 +37,7 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/free-map.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -248,6 +249,18 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache-policy"))
+        cache_set_policy (value);
+      else if (!strcmp (name, "-cache-flush"))
+        cache_set_flush_period (atoi (value));
+      else if (!strcmp (name, "-cache-dirty"))
+        cache_set_dirty_bg (atoi (value));
+      else if (!strcmp (name, "-cache-throttle"))
+        cache_set_dirty_max (atoi (value));
+      else if (!strcmp (name, "-cache-max"))
+        cache_set_max (atoi (value));
+      else if (!strcmp (name, "-free-map"))
+        free_map_set_format (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -374,6 +387,15 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache-policy=NAME Use buffer cache replacement policy NAME\n"
+          "                     (lru, clock or 2q).\n"
+          "  -cache-flush=MS    Write dirty cache sectors back every MS ms.\n"
+          "  -cache-dirty=PCT   Start write-back early above PCT%% dirty.\n"
+          "  -cache-throttle=PCT\n"
+          "                     Make writers wait above PCT%% dirty.\n"
+          "  -cache-max=N       Let the buffer cache grow to N sectors.\n"
+          "  -free-map=KIND     With -f, keep free space in a bitmap or\n"
+          "                     a free-extent tree (bitmap or extents).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
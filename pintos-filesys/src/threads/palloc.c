@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -29,15 +30,20 @@
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct bitmap *used_map;            /* Bitmap of free pages, with a
+                                           summary; see take_pages(). */
     uint8_t *base;                      /* Base of pool. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Called to free memory when an allocation would fail. */
+static palloc_shrink_func *shrinker;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
+static size_t take_pages (struct pool *, size_t page_cnt);
 static bool page_from_pool (const struct pool *, void *page);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
@@ -61,6 +67,17 @@ palloc_init (size_t user_page_limit)
              user_pages, "user pool");
 }
 
+/* Registers SHRINK to be called when there are too few free
+   pages for an allocation.  The allocation is retried for as
+   long as SHRINK reports freeing pages.  SHRINK may be called
+   with any lock held, so it must not wait for a lock that a
+   thread blocked in the allocator could be holding. */
+void
+palloc_set_shrinker (palloc_shrink_func *shrink)
+{
+  shrinker = shrink;
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -78,9 +95,20 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  page_idx = take_pages (pool, page_cnt);
   lock_release (&pool->lock);
 
+  /* Out of pages: have the shrinker give some back and retry.
+     The freed pages may be in the other pool or not contiguous
+     with other free ones, so keep going while it makes progress. */
+  while (page_idx == BITMAP_ERROR && shrinker != NULL
+         && shrinker (page_cnt) > 0)
+    {
+      lock_acquire (&pool->lock);
+      page_idx = take_pages (pool, page_cnt);
+      lock_release (&pool->lock);
+    }
+
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
   else
@@ -119,6 +147,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -137,8 +166,10 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -153,10 +184,13 @@ palloc_free_page (void *page)
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map, followed by its summary, at
+     its base.  Calculate the space needed for the bitmap and
+     subtract it from the pool's size.  That leaves fewer pages
+     to map, so the bitmap sized for all of them is big enough. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t sum_size = bitmap_summary_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + sum_size, PGSIZE);
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,10 +199,28 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  bitmap_summarize (p->used_map, (uint8_t *) base + bm_size, sum_size);
   p->base = base + bm_pages * PGSIZE;
 }
 
+/* Takes PAGE_CNT consecutive free pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if there is no such run.
+   Caller must hold POOL's lock.  The used_map summary is updated
+   along with the bitmap, not atomically with it, and
+   palloc_free_multiple() can't take the lock, since the scheduler
+   frees dying threads' pages, so both work on used_map with
+   interrupts off. */
+static size_t
+take_pages (struct pool *pool, size_t page_cnt)
+{
+  enum intr_level old_level = intr_disable ();
+  size_t page_idx = bitmap_scan_and_flip_next (pool->used_map, page_cnt,
+                                               false);
+  intr_set_level (old_level);
+  return page_idx;
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
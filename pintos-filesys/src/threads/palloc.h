@@ -11,7 +11,12 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Frees up to PAGE_CNT pages for an allocation that would
+   otherwise fail and returns the number freed. */
+typedef size_t palloc_shrink_func (size_t page_cnt);
+
 void palloc_init (size_t user_page_limit);
+void palloc_set_shrinker (palloc_shrink_func *);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
@@ -336,3 +336,133 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW as a readers-writer lock, which any number of
+   readers may hold at once, or else a single writer.
+
+   Readers are let in whenever no writer holds RW, even if a
+   writer is waiting.  That can starve writers, but it means a
+   thread holding RW for reading can never block another reader,
+   which would otherwise be easy to deadlock on. */
+void
+rw_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->changed);
+  rw->readers = 0;
+  rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rw_acquire_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL)
+    cond_wait (&rw->changed, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
+}
+
+/* Tries to acquire RW for reading and returns true if
+   successful or false on failure.  RW must not already be held
+   for writing by the current thread.
+
+   This function will not sleep. */
+bool
+rw_try_acquire_read (struct rwlock *rw)
+{
+  bool success;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  if (!lock_try_acquire (&rw->lock))
+    return false;
+  success = rw->writer == NULL;
+  if (success)
+    rw->readers++;
+  lock_release (&rw->lock);
+  return success;
+}
+
+/* Acquires RW for writing, sleeping until nobody else holds it.
+   RW must not already be held by the current thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rw_acquire_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->readers > 0)
+    cond_wait (&rw->changed, &rw->lock);
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
+}
+
+/* Tries to acquire RW for writing and returns true if
+   successful or false on failure.  RW must not already be held by
+   the current thread.
+
+   This function will not sleep. */
+bool
+rw_try_acquire_write (struct rwlock *rw)
+{
+  bool success;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer != thread_current ());
+
+  if (!lock_try_acquire (&rw->lock))
+    return false;
+  success = rw->writer == NULL && rw->readers == 0;
+  if (success)
+    rw->writer = thread_current ();
+  lock_release (&rw->lock);
+  return success;
+}
+
+/* Releases RW, which the current thread must hold, for reading
+   or for writing. */
+void
+rw_release (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  if (rw->writer != NULL)
+    {
+      ASSERT (rw->writer == thread_current ());
+      rw->writer = NULL;
+    }
+  else
+    {
+      ASSERT (rw->readers > 0);
+      rw->readers--;
+    }
+  if (rw->writer == NULL && rw->readers == 0)
+    cond_broadcast (&rw->changed, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing,
+   false otherwise. */
+bool
+rw_held_for_write (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
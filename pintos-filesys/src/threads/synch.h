@@ -41,6 +41,23 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Guards the fields below. */
+    struct condition changed;   /* Signaled when RW becomes free. */
+    int readers;                /* Number of readers holding RW. */
+    struct thread *writer;      /* Writer holding RW, if any. */
+  };
+
+void rw_init (struct rwlock *);
+void rw_acquire_read (struct rwlock *);
+bool rw_try_acquire_read (struct rwlock *);
+void rw_acquire_write (struct rwlock *);
+bool rw_try_acquire_write (struct rwlock *);
+void rw_release (struct rwlock *);
+bool rw_held_for_write (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
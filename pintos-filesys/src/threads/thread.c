@@ -40,9 +40,6 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
-// global file lock for file manipulation
-static struct lock file_lock;
-
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
   {
@@ -96,7 +93,6 @@ thread_init (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  lock_init(&file_lock);
   list_init (&ready_list);
   list_init (&all_list);
 
@@ -646,14 +642,6 @@ allocate_tid (void)
   return tid;
 }
 
-void acquire_file_lock(){
-  lock_acquire(&file_lock);
-}
-
-void release_file_lock(){
-  lock_release(&file_lock);
-}
-
 /* Offset of `stack' member within `struct thread'.
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
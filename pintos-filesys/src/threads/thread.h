@@ -164,8 +164,6 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-void acquire_file_lock(void);
-void release_file_lock(void);
 
 
 int child_thread_wait(int);
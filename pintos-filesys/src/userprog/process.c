@@ -85,12 +85,10 @@ start_process (void *file_name_)
   
   struct thread *cur = thread_current();
   
-  // lock the executable file that belongs to thread_current()
-  acquire_file_lock();
+  // open the executable file that belongs to thread_current()
   cur->executable = filesys_open(token);
   // once executable file is opened, deny other writing requests
   if(cur->executable != NULL) file_deny_write(cur->executable);
-  release_file_lock();
 
   cur->parent->exec_status = success;
 
@@ -284,7 +282,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
   process_activate ();
 
   /* Open executable file. */
-  acquire_file_lock();
   file = filesys_open (file_name);
   if (file == NULL)
     {
@@ -377,7 +374,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
  done:
   /* We arrive here whether the load is successful or not. */
   file_close(file);
-  release_file_lock();
   return success;
 }
 
@@ -16,6 +16,8 @@
 #include "syscall.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/cache.h"
+#include "filesys/free-map.h"
 
 // syscall array
 syscall_function syscalls[SYSCALL_NUMBER];
@@ -56,8 +58,7 @@ syscall_init (void)
   syscalls[SYS_READDIR] = sys_readdir;
   syscalls[SYS_ISDIR] = sys_isdir;
   syscalls[SYS_INUMBER] = sys_inumber;
-
-  lock_init(&DirOpenLock);
+  syscalls[SYS_CACHE_STATS] = sys_cache_stats;
 }
 
 // check whether page p and p+3 has been in kernel virtual memory
@@ -81,6 +82,17 @@ void check(void *p) {
   check_page(p);
 }
 
+// make check for every page of the SIZE bytes from p
+void check_buffer(void *p, size_t size) {
+  void *last;
+  if(size < 4) size = 4;
+  last = p + size - 4;
+  check(p);
+  for(p = pg_round_down(p) + PGSIZE; p < last; p += PGSIZE)
+    check(p);
+  check(last);
+}
+
 // make check for every function arguments
 void check_func_args(void *p, int argc) {
   for(int i = 0; i < argc; i++) {
@@ -148,10 +160,8 @@ void sys_create(struct intr_frame * f) {
     f->eax = false;
     return;
   }
-  acquire_file_lock();
   // thread_exit ();
   f->eax = filesys_create(path,*(p + 2));
-  release_file_lock();
   free(path);
 }
 
@@ -161,9 +171,7 @@ void sys_remove(struct intr_frame * f) {
   check_func_args((void *)(p + 1), 1);
   check((void*)*(p + 1));
   char *path = get_path((const char *)*(p + 1));
-  acquire_file_lock();
   f->eax = filesys_remove(path);
-  release_file_lock();
   free(path);
 }
 
@@ -174,9 +182,7 @@ void sys_open(struct intr_frame * f) {
 
   struct thread * t = thread_current();
   char *path = get_path((const char *)*(p + 1));
-  acquire_file_lock();
   struct file * open_f = filesys_open(path);
-  release_file_lock();
   free(path);
   // check whether the open file is valid
   if(open_f){
@@ -196,9 +202,7 @@ void sys_filesize(struct intr_frame * f) {
   struct file_node * open_f = find_file(&thread_current()->files, *(p + 1));
   // check whether the write file is valid
   if (open_f){
-    acquire_file_lock();
     f->eax = file_length(open_f->file);
-    release_file_lock();
   } else
     f->eax = -1;
 }
@@ -221,9 +225,7 @@ void sys_read(struct intr_frame * f) {
     struct file_node * open_f = find_file(&thread_current()->files, *(p + 1));
     // check whether the read file is valid
     if (open_f){
-      acquire_file_lock();
       f->eax = file_read(open_f->file, buffer, size);
-      release_file_lock();
     } else
       f->eax = -1;
   }
@@ -249,9 +251,7 @@ void sys_write(struct intr_frame * f) {
       {
         f->eax = -1;
       }else{
-        acquire_file_lock();
         f->eax = file_write(openf->file, buffer2, size2);
-        release_file_lock();
       }
     } else
       f->eax = 0;
@@ -263,9 +263,7 @@ void sys_seek(struct intr_frame * f) {
   check_func_args((void *)(p + 1), 2);
   struct file_node * openf = find_file(&thread_current()->files, *(p + 1));
   if (openf){
-    acquire_file_lock();
     file_seek(openf->file, *(p + 2));
-    release_file_lock();
   }
 }
 
@@ -275,9 +273,7 @@ void sys_tell(struct intr_frame * f) {
   struct file_node * open_f = find_file(&thread_current()->files, *(p + 1));
   // check whether the tell file is valid
   if (open_f){
-    acquire_file_lock();
     f->eax = file_tell(open_f->file);
-    release_file_lock();
   }else
     f->eax = -1;
 }
@@ -287,9 +283,7 @@ void sys_close(struct intr_frame * f) {
   check_func_args((void *)(p + 1), 1);
   struct file_node * openf = find_file(&thread_current()->files, *(p + 1));
   if (openf){
-    acquire_file_lock();
     file_close(openf->file);
-    release_file_lock();
     // remove file form file list
     list_remove(&openf->file_elem);
     free(openf);
@@ -327,7 +321,8 @@ void sys_mkdir(struct intr_frame *f)
  int cur;
  struct dir *dir=path_open(path,&cur);
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate (inode_get_inumber (dir_get_inode (dir)),
+                                        1, &inode_sector)
                   && inode_create_extend (inode_sector, 20*sizeof(struct dir_entry),1)
                   && dir_add(dir,path+cur, inode_sector));
   if (!success && inode_sector != 0) 
@@ -421,6 +416,19 @@ void sys_isdir(struct intr_frame *f)
   f->eax= fn->file->inode->data.isdir;
 }
 
+// copy the buffer cache statistics out to the user
+void sys_cache_stats(struct intr_frame *f)
+{
+  int *p = f->esp;
+  check_func_args((void *)(p + 1), 1);
+  struct cache_stats *stats = (struct cache_stats *)*(p + 1);
+  struct cache_stats tmp;
+  check_buffer((void *)stats, sizeof *stats);
+  cache_get_stats(&tmp);
+  memcpy(stats, &tmp, sizeof tmp);
+  f->eax = 1;
+}
+
 void copy_to(char *to,const char *from)
 {
   while(*to++=*from++);
@@ -6,13 +6,14 @@
 
 
 typedef void (*syscall_function) (struct intr_frame *);
-#define SYSCALL_NUMBER 20
+#define SYSCALL_NUMBER 21
 #define MAX_PATH 1320
 
 void syscall_init (void);
 
 void check(void *);
 void check_func_args(void *, int);
+void check_buffer(void *, size_t);
 void check_page(void *);
 void check_addr(void *p);
 
@@ -35,6 +36,7 @@ void sys_chdir(struct intr_frame *f);
 void sys_readdir(struct intr_frame *f);
 void sys_inumber(struct intr_frame *f);
 void sys_isdir(struct intr_frame *f);
+void sys_cache_stats(struct intr_frame *f);
 
 
 struct file_node * find_file(struct list *, int);